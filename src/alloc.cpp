@@ -0,0 +1,113 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "alloc.hpp"
+
+#ifdef ALLOC_STATS
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+
+// glibc entry points behind malloc and friends
+extern "C"
+{
+void* __libc_malloc(std::size_t);
+void* __libc_calloc(std::size_t, std::size_t);
+void* __libc_realloc(void*, std::size_t);
+void* __libc_memalign(std::size_t, std::size_t);
+void  __libc_free(void*);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+namespace alloc
+{
+
+namespace
+{
+
+thread_local site current = other;
+
+std::atomic<std::size_t> count[num_sites];
+std::atomic<std::size_t> bytes[num_sites];
+
+inline void charge(std::size_t n) noexcept
+{
+    count[current].fetch_add(1, std::memory_order_relaxed);
+    bytes[current].fetch_add(n, std::memory_order_relaxed);
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+scope::scope(alloc::site site) noexcept : prev_{current} { current = site; }
+scope::~scope() { current = prev_; }
+
+alloc::stats take() noexcept
+{
+    alloc::stats stats;
+    for (std::size_t n = 0; n < num_sites; ++n)
+    {
+        stats.count[n] = count[n].exchange(0, std::memory_order_relaxed);
+        stats.bytes[n] = bytes[n].exchange(0, std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// operator new, g_malloc, pixman, etc. all end up here
+extern "C"
+{
+void* malloc(std::size_t n) noexcept
+{
+    alloc::charge(n);
+    return __libc_malloc(n);
+}
+
+void* calloc(std::size_t num, std::size_t n) noexcept
+{
+    alloc::charge(num * n);
+    return __libc_calloc(num, n);
+}
+
+void* realloc(void* p, std::size_t n) noexcept
+{
+    alloc::charge(n);
+    return __libc_realloc(p, n);
+}
+
+// over-aligned operator new and pmr resources come through these
+void* memalign(std::size_t align, std::size_t n) noexcept
+{
+    alloc::charge(n);
+    return __libc_memalign(align, n);
+}
+
+void* aligned_alloc(std::size_t align, std::size_t n) noexcept
+{
+    alloc::charge(n);
+    return __libc_memalign(align, n);
+}
+
+int posix_memalign(void** p, std::size_t align, std::size_t n) noexcept
+{
+    if (align % sizeof(void*) || (align & (align - 1))) return EINVAL;
+
+    alloc::charge(n);
+    auto q = __libc_memalign(align, n);
+    if (!q) return ENOMEM;
+
+    *p = q;
+    return 0;
+}
+
+void free(void* p) noexcept { __libc_free(p); }
+}
+
+#endif
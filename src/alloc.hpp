@@ -0,0 +1,70 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstddef>
+
+////////////////////////////////////////////////////////////////////////////////
+// heap allocation accounting
+//
+// When built with ALLOC_STATS, malloc and friends are interposed and every
+// allocation is charged to the innermost active call site. Otherwise
+// everything here compiles to nothing.
+//
+namespace alloc
+{
+
+enum site { other, cells, render, attrs, image, num_sites };
+
+constexpr const char* site_names[num_sites] = { "other", "machine::cells", "engine::render", "create_attrs", "pixman::image" };
+
+struct stats
+{
+    std::size_t count[num_sites] { };
+    std::size_t bytes[num_sites] { };
+
+    auto total() const noexcept
+    {
+        std::size_t n = 0;
+        for (auto c : count) n += c;
+        return n;
+    }
+};
+
+#ifdef ALLOC_STATS
+constexpr bool enabled = true;
+
+// charge allocations made during the lifetime of this object to the site
+class scope
+{
+public:
+    ////////////////////
+    explicit scope(alloc::site) noexcept;
+    ~scope();
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+private:
+    ////////////////////
+    alloc::site prev_;
+};
+
+// return stats accumulated since the last call and reset them
+alloc::stats take() noexcept;
+
+#else
+constexpr bool enabled = false;
+
+struct scope { explicit scope(alloc::site) noexcept { } };
+
+inline alloc::stats take() noexcept { return {}; }
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,85 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace arena
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// frame-scoped bump allocator
+//
+// Scratch buffers of the render path are carved out of one pre-allocated
+// block and are all released at once by reset(). If a frame doesn't fit,
+// the excess is taken from the heap and the block is grown on next reset().
+//
+// NB: memory obtained during a frame must not be used after reset()
+//
+class frame : public std::pmr::memory_resource
+{
+public:
+    ////////////////////
+    explicit frame(std::size_t size) :
+        size_{size}, block_{new std::byte[size_]}
+    {
+        pool_.emplace(block_.get(), size_, &spill_);
+    }
+
+    auto capacity() const noexcept { return size_; }
+
+    void reset()
+    {
+        pool_->release();
+        if (spill_.size)
+        {
+            pool_.reset();
+
+            size_ += spill_.size;
+            block_.reset(new std::byte[size_]);
+            spill_.size = 0;
+
+            pool_.emplace(block_.get(), size_, &spill_);
+        }
+    }
+
+private:
+    ////////////////////
+    // heap fallback that keeps track of how much it had to hand out
+    struct spill : std::pmr::memory_resource
+    {
+        std::size_t size = 0;
+
+        void* do_allocate(std::size_t n, std::size_t align) override
+        {
+            size += n;
+            return std::pmr::new_delete_resource()->allocate(n, align);
+        }
+        void do_deallocate(void* p, std::size_t n, std::size_t align) override
+        {
+            std::pmr::new_delete_resource()->deallocate(p, n, align);
+        }
+        bool do_is_equal(const memory_resource& other) const noexcept override { return this == &other; }
+    };
+
+    std::size_t size_;
+    std::unique_ptr<std::byte[]> block_;
+    spill spill_;
+    std::optional<std::pmr::monotonic_buffer_resource> pool_;
+
+    void* do_allocate(std::size_t n, std::size_t align) override { return pool_->allocate(n, align); }
+    void do_deallocate(void*, std::size_t, std::size_t) override { }
+    bool do_is_equal(const memory_resource& other) const noexcept override { return this == &other; }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
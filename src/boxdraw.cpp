@@ -0,0 +1,358 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "font.hpp"
+
+#include <algorithm> // std::clamp, std::max, std::min
+#include <cmath> // std::abs, std::hypot
+
+////////////////////////////////////////////////////////////////////////////////
+namespace font
+{
+
+namespace
+{
+
+// line weights
+enum weight : std::uint8_t { none, light, heavy, twin };
+
+// left, right, up and down arm weights of the box-drawing characters
+struct arms { weight l, r, u, d; };
+
+constexpr arms lines[] =
+{
+    {light, light, none, none}, {heavy, heavy, none, none}, {none, none, light, light}, {none, none, heavy, heavy}, // ─━│┃
+    {}, {}, {}, {}, {}, {}, {}, {}, // ┄┅┆┇┈┉┊┋ (dashes)
+    {none, light, none, light}, {none, heavy, none, light}, {none, light, none, heavy}, {none, heavy, none, heavy}, // ┌┍┎┏
+    {light, none, none, light}, {heavy, none, none, light}, {light, none, none, heavy}, {heavy, none, none, heavy}, // ┐┑┒┓
+    {none, light, light, none}, {none, heavy, light, none}, {none, light, heavy, none}, {none, heavy, heavy, none}, // └┕┖┗
+    {light, none, light, none}, {heavy, none, light, none}, {light, none, heavy, none}, {heavy, none, heavy, none}, // ┘┙┚┛
+    {none, light, light, light}, {none, heavy, light, light}, {none, light, heavy, light}, {none, light, light, heavy}, // ├┝┞┟
+    {none, light, heavy, heavy}, {none, heavy, heavy, light}, {none, heavy, light, heavy}, {none, heavy, heavy, heavy}, // ┠┡┢┣
+    {light, none, light, light}, {heavy, none, light, light}, {light, none, heavy, light}, {light, none, light, heavy}, // ┤┥┦┧
+    {light, none, heavy, heavy}, {heavy, none, heavy, light}, {heavy, none, light, heavy}, {heavy, none, heavy, heavy}, // ┨┩┪┫
+    {light, light, none, light}, {heavy, light, none, light}, {light, heavy, none, light}, {heavy, heavy, none, light}, // ┬┭┮┯
+    {light, light, none, heavy}, {heavy, light, none, heavy}, {light, heavy, none, heavy}, {heavy, heavy, none, heavy}, // ┰┱┲┳
+    {light, light, light, none}, {heavy, light, light, none}, {light, heavy, light, none}, {heavy, heavy, light, none}, // ┴┵┶┷
+    {light, light, heavy, none}, {heavy, light, heavy, none}, {light, heavy, heavy, none}, {heavy, heavy, heavy, none}, // ┸┹┺┻
+    {light, light, light, light}, {heavy, light, light, light}, {light, heavy, light, light}, {heavy, heavy, light, light}, // ┼┽┾┿
+    {light, light, heavy, light}, {light, light, light, heavy}, {light, light, heavy, heavy}, {heavy, light, heavy, light}, // ╀╁╂╃
+    {light, heavy, heavy, light}, {heavy, light, light, heavy}, {light, heavy, light, heavy}, {heavy, heavy, heavy, light}, // ╄╅╆╇
+    {heavy, heavy, light, heavy}, {heavy, light, heavy, heavy}, {light, heavy, heavy, heavy}, {heavy, heavy, heavy, heavy}, // ╈╉╊╋
+    {}, {}, {}, {}, // ╌╍╎╏ (dashes)
+    {twin, twin, none, none}, {none, none, twin, twin}, // ═║
+    {none, twin, none, light}, {none, light, none, twin}, {none, twin, none, twin}, // ╒╓╔
+    {twin, none, none, light}, {light, none, none, twin}, {twin, none, none, twin}, // ╕╖╗
+    {none, twin, light, none}, {none, light, twin, none}, {none, twin, twin, none}, // ╘╙╚
+    {twin, none, light, none}, {light, none, twin, none}, {twin, none, twin, none}, // ╛╜╝
+    {none, twin, light, light}, {none, light, twin, twin}, {none, twin, twin, twin}, // ╞╟╠
+    {twin, none, light, light}, {light, none, twin, twin}, {twin, none, twin, twin}, // ╡╢╣
+    {twin, twin, none, light}, {light, light, none, twin}, {twin, twin, none, twin}, // ╤╥╦
+    {twin, twin, light, none}, {light, light, twin, none}, {twin, twin, twin, none}, // ╧╨╩
+    {twin, twin, light, light}, {light, light, twin, twin}, {twin, twin, twin, twin}, // ╪╫╬
+    {}, {}, {}, {}, {}, {}, {}, // ╭╮╯╰╱╲╳ (arcs and diagonals)
+    {light, none, none, none}, {none, none, light, none}, {none, light, none, none}, {none, none, none, light}, // ╴╵╶╷
+    {heavy, none, none, none}, {none, none, heavy, none}, {none, heavy, none, none}, {none, none, none, heavy}, // ╸╹╺╻
+    {light, heavy, none, none}, {none, none, light, heavy}, {heavy, light, none, none}, {none, none, heavy, light}, // ╼╽╾╿
+};
+static_assert(std::size(lines) == 0x80);
+
+////////////////////////////////////////////////////////////////////////////////
+class canvas
+{
+public:
+    ////////////////////
+    canvas(pixman::gray& mask) :
+        data_{mask.data<std::uint8_t*>()}, stride_{mask.stride()},
+        w_{static_cast<int>(mask.width())}, h_{static_cast<int>(mask.height())},
+        lt_{std::max(1, w_ / 8)}, ht_{2 * lt_}
+    { }
+
+    void fill(int x0, int y0, int x1, int y1, std::uint8_t alpha = 0xff)
+    {
+        x0 = std::clamp(x0, 0, w_); x1 = std::clamp(x1, 0, w_);
+        y0 = std::clamp(y0, 0, h_); y1 = std::clamp(y1, 0, h_);
+
+        for (auto y = y0; y < y1; ++y)
+            for (auto x = x0; x < x1; ++x) data_[y * stride_ + x] = alpha;
+    }
+
+    // blend coverage in [0, 1]
+    void cover(int x, int y, float coverage)
+    {
+        if (x >= 0 && x < w_ && y >= 0 && y < h_)
+        {
+            auto& p = data_[y * stride_ + x];
+            p = std::max<int>(p, std::clamp(coverage, 0.f, 1.f) * 0xff + .5f);
+        }
+    }
+
+    void draw(const arms&);
+    void draw_dashes(bool vertical, weight, int count);
+    void draw_arc(int sx, int sy);
+    void draw_diagonal(bool down);
+
+    void draw_block(char32_t);
+    void draw_braille(std::uint8_t dots);
+
+private:
+    ////////////////////
+    std::uint8_t* data_;
+    std::size_t stride_;
+    int w_, h_;
+    int lt_, ht_; // light and heavy line thickness
+
+    int thickness(weight wt) const { return wt == heavy ? ht_ : lt_; }
+    int thickness(weight a, weight b) const { return std::max(a ? thickness(a) : 0, b ? thickness(b) : 0); }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+void canvas::draw(const arms& a)
+{
+    // single line: [start, start + t); double line: [start, start + lt) and [start + 2lt, start + 3lt)
+    auto single = [](int size, int t) { return (size - t) / 2; };
+    auto twin0 = [&](int size) { return (size - 3 * lt_) / 2; };
+    auto twin1 = [&](int size) { return twin0(size) + 2 * lt_; };
+
+    bool vtwin = a.u == twin || a.d == twin;
+    bool htwin = a.l == twin || a.r == twin;
+    auto vt = thickness(a.u, a.d), ht = thickness(a.l, a.r);
+
+    // where a horizontal stroke on the side of the perpendicular arm 'near' meets the vertical
+    // lines: 'inner' edge if 'near' is double, 'outer' edge if only 'far' is double, etc.
+    auto right_from = [&](weight near, weight far)
+    {
+        if (near == twin) return twin1(w_);
+        if (far == twin) return twin0(w_);
+        if (near || far) return single(w_, vt);
+        return w_ / 2;
+    };
+    auto left_to = [&](weight near, weight far)
+    {
+        if (near == twin) return twin0(w_) + lt_;
+        if (far == twin) return twin1(w_) + lt_;
+        if (near || far) return single(w_, vt) + vt;
+        return w_ / 2;
+    };
+    auto down_from = [&](weight near, weight far)
+    {
+        if (near == twin) return twin1(h_);
+        if (far == twin) return twin0(h_);
+        if (near || far) return single(h_, ht);
+        return h_ / 2;
+    };
+    auto up_to = [&](weight near, weight far)
+    {
+        if (near == twin) return twin0(h_) + lt_;
+        if (far == twin) return twin1(h_) + lt_;
+        if (near || far) return single(h_, ht) + ht;
+        return h_ / 2;
+    };
+
+    // horizontal arms
+    if (a.r == twin)
+    {
+        fill(right_from(a.u, a.d), twin0(h_), w_, twin0(h_) + lt_);
+        fill(right_from(a.d, a.u), twin1(h_), w_, twin1(h_) + lt_);
+    }
+    else if (a.r)
+    {
+        auto t = thickness(a.r);
+        auto x0 = vtwin ? twin1(w_) : (a.u || a.d) ? single(w_, vt) : single(w_, t);
+        fill(x0, single(h_, t), w_, single(h_, t) + t);
+    }
+
+    if (a.l == twin)
+    {
+        fill(0, twin0(h_), left_to(a.u, a.d), twin0(h_) + lt_);
+        fill(0, twin1(h_), left_to(a.d, a.u), twin1(h_) + lt_);
+    }
+    else if (a.l)
+    {
+        auto t = thickness(a.l);
+        auto x1 = vtwin ? twin0(w_) + lt_ : (a.u || a.d) ? single(w_, vt) + vt : single(w_, t) + t;
+        fill(0, single(h_, t), x1, single(h_, t) + t);
+    }
+
+    // vertical arms
+    if (a.d == twin)
+    {
+        fill(twin0(w_), down_from(a.l, a.r), twin0(w_) + lt_, h_);
+        fill(twin1(w_), down_from(a.r, a.l), twin1(w_) + lt_, h_);
+    }
+    else if (a.d)
+    {
+        auto t = thickness(a.d);
+        auto y0 = htwin ? twin1(h_) : (a.l || a.r) ? single(h_, ht) : single(h_, t);
+        fill(single(w_, t), y0, single(w_, t) + t, h_);
+    }
+
+    if (a.u == twin)
+    {
+        fill(twin0(w_), 0, twin0(w_) + lt_, up_to(a.l, a.r));
+        fill(twin1(w_), 0, twin1(w_) + lt_, up_to(a.r, a.l));
+    }
+    else if (a.u)
+    {
+        auto t = thickness(a.u);
+        auto y1 = htwin ? twin0(h_) + lt_ : (a.l || a.r) ? single(h_, ht) + ht : single(h_, t) + t;
+        fill(single(w_, t), 0, single(w_, t) + t, y1);
+    }
+}
+
+void canvas::draw_dashes(bool vertical, weight wt, int count)
+{
+    auto t = thickness(wt);
+    auto size = vertical ? h_ : w_;
+    auto gap = std::max(1, size / (4 * count));
+
+    for (auto n = 0; n < count; ++n)
+    {
+        auto from = n * size / count + gap / 2, to = (n + 1) * size / count - (gap - gap / 2);
+        if (vertical)
+            fill((w_ - t) / 2, from, (w_ - t) / 2 + t, to);
+        else fill(from, (h_ - t) / 2, to, (h_ - t) / 2 + t);
+    }
+}
+
+// rounded corner with arms going in the sx and sy direction
+void canvas::draw_arc(int sx, int sy)
+{
+    auto t = lt_;
+    auto x0 = (w_ - t) / 2, y0 = (h_ - t) / 2;
+    float mx = x0 + t / 2.f, my = y0 + t / 2.f;
+
+    auto r = std::min(sx > 0 ? w_ - mx : mx, sy > 0 ? h_ - my : my);
+    float cx = mx + sx * r, cy = my + sy * r;
+
+    for (auto y = 0; y < h_; ++y)
+        for (auto x = 0; x < w_; ++x)
+        {
+            float px = x + .5f, py = y + .5f;
+            if ((px - cx) * sx <= 0 && (py - cy) * sy <= 0)
+            {
+                auto d = std::hypot(px - cx, py - cy);
+                cover(x, y, t / 2.f + .5f - std::abs(d - r));
+            }
+        }
+
+    // straight bits from the arc to the edges
+    if (sx > 0) fill(cx, y0, w_, y0 + t); else fill(0, y0, cx, y0 + t);
+    if (sy > 0) fill(x0, cy, x0 + t, h_); else fill(x0, 0, x0 + t, cy);
+}
+
+void canvas::draw_diagonal(bool down)
+{
+    // line through (0, 0)-(w, h) or (0, h)-(w, 0)
+    float dx = w_, dy = down ? h_ : -h_, len = std::hypot(dx, dy);
+    float oy = down ? 0 : h_;
+
+    for (auto y = 0; y < h_; ++y)
+        for (auto x = 0; x < w_; ++x)
+        {
+            float px = x + .5f, py = y + .5f - oy;
+            auto dist = std::abs(px * dy - py * dx) / len;
+            cover(x, y, lt_ / 2.f + .5f - dist);
+        }
+}
+
+void canvas::draw_block(char32_t cp)
+{
+    auto x8 = [&](int n) { return (w_ * n + 4) / 8; };
+    auto y8 = [&](int n) { return (h_ * n + 4) / 8; };
+
+    enum quadrant { ul = 1, ur = 2, ll = 4, lr = 8 };
+    constexpr std::uint8_t quadrants[] =
+    {
+        ll, lr, ul, ul | ll | lr, ul | lr, ul | ur | ll, ul | ur | lr, ur, ur | ll, ur | ll | lr // ▖▗▘▙▚▛▜▝▞▟
+    };
+
+    if (cp == 0x2580) fill(0, 0, w_, y8(4)); // ▀
+    else if (cp <= 0x2588) fill(0, y8(8 - (cp - 0x2580)), w_, h_); // ▁▂▃▄▅▆▇█
+    else if (cp <= 0x258f) fill(0, 0, x8(8 - (cp - 0x2588)), h_); // ▉▊▋▌▍▎▏
+    else if (cp == 0x2590) fill(x8(4), 0, w_, h_); // ▐
+    else if (cp <= 0x2593) fill(0, 0, w_, h_, 0x40 * (cp - 0x2590)); // ░▒▓
+    else if (cp == 0x2594) fill(0, 0, w_, y8(1)); // ▔
+    else if (cp == 0x2595) fill(x8(7), 0, w_, h_); // ▕
+    else
+    {
+        auto q = quadrants[cp - 0x2596];
+        auto mx = x8(4), my = y8(4);
+        if (q & ul) fill( 0,  0, mx, my);
+        if (q & ur) fill(mx,  0, w_, my);
+        if (q & ll) fill( 0, my, mx, h_);
+        if (q & lr) fill(mx, my, w_, h_);
+    }
+}
+
+void canvas::draw_braille(std::uint8_t dots)
+{
+    // dot bit => column and row
+    constexpr int cols[] = { 0, 0, 0, 1, 1, 1, 0, 1 };
+    constexpr int rows[] = { 0, 1, 2, 0, 1, 2, 3, 3 };
+
+    auto cw = w_ / 2, ch = h_ / 4;
+    auto size = std::max(1, std::min(cw, ch) / 2 + 1);
+
+    for (auto n = 0; n < 8; ++n)
+        if (dots & (1 << n))
+        {
+            auto x = cols[n] * cw + (cw - size) / 2, y = rows[n] * ch + (ch - size) / 2;
+            fill(x, y, x + size, y + size);
+        }
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::optional<pixman::gray> draw_procedural(char32_t cp, unsigned w, unsigned h, const vte::attrs& attrs)
+{
+    if (!is_procedural(cp)) return {};
+
+    pixman::gray mask{w, h};
+    canvas cv{mask};
+
+    if (cp >= 0x2800)
+        cv.draw_braille(cp - 0x2800);
+
+    else if (cp >= 0x2580)
+        cv.draw_block(cp);
+
+    else switch (cp)
+    {
+    case 0x2504: case 0x2505: cv.draw_dashes(false, cp & 1 ? heavy : light, 3); break; // ┄┅
+    case 0x2506: case 0x2507: cv.draw_dashes(true , cp & 1 ? heavy : light, 3); break; // ┆┇
+    case 0x2508: case 0x2509: cv.draw_dashes(false, cp & 1 ? heavy : light, 4); break; // ┈┉
+    case 0x250a: case 0x250b: cv.draw_dashes(true , cp & 1 ? heavy : light, 4); break; // ┊┋
+    case 0x254c: case 0x254d: cv.draw_dashes(false, cp & 1 ? heavy : light, 2); break; // ╌╍
+    case 0x254e: case 0x254f: cv.draw_dashes(true , cp & 1 ? heavy : light, 2); break; // ╎╏
+
+    case 0x256d: cv.draw_arc(+1, +1); break; // ╭
+    case 0x256e: cv.draw_arc(-1, +1); break; // ╮
+    case 0x256f: cv.draw_arc(-1, -1); break; // ╯
+    case 0x2570: cv.draw_arc(+1, -1); break; // ╰
+
+    case 0x2571: cv.draw_diagonal(false); break; // ╱
+    case 0x2572: cv.draw_diagonal(true); break; // ╲
+    case 0x2573: cv.draw_diagonal(false); cv.draw_diagonal(true); break; // ╳
+
+    default: cv.draw(lines[cp - 0x2500]);
+    }
+
+    int x = w, y = h;
+    if (attrs.underline)
+    {
+        cv.fill(0, y - 1, x, y);
+        if (attrs.underline == 2) cv.fill(0, y - 3, x, y - 2);
+    }
+    if (attrs.strike) cv.fill(0, y / 2, x, y / 2 + 1);
+
+    return mask;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,111 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace cache
+{
+
+struct stats
+{
+    std::size_t hits = 0, misses = 0;
+    std::size_t size = 0, entries = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// least-recently-used cache with a memory budget
+//
+// NB: pointers returned by find() and references returned by insert() remain
+// valid until the entry is evicted (or replaced) by a subsequent insert()
+//
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class lru
+{
+public:
+    ////////////////////
+    explicit lru(std::size_t budget) : budget_{budget} { }
+
+    Value* find(const Key& key)
+    {
+        auto it = map_.find(key);
+        if (it == map_.end())
+        {
+            ++stats_.misses;
+            return nullptr;
+        }
+
+        ++stats_.hits;
+        list_.splice(list_.begin(), list_, it->second);
+        return &it->second->value;
+    }
+
+    // replaces the entry if the key is already there
+    Value& insert(const Key& key, Value value, std::size_t size)
+    {
+        if (auto it = map_.find(key); it != map_.end())
+        {
+            stats_.size -= it->second->size;
+            list_.erase(it->second);
+            map_.erase(it);
+        }
+
+        while (list_.size() && stats_.size + size > budget_) evict();
+
+        list_.push_front(entry{key, std::move(value), size});
+        map_.emplace(key, list_.begin());
+
+        stats_.size += size;
+        stats_.entries = list_.size();
+
+        return list_.front().value;
+    }
+
+    void clear()
+    {
+        map_.clear();
+        list_.clear();
+        stats_.size = stats_.entries = 0;
+    }
+
+    constexpr auto& stats() const noexcept { return stats_; }
+
+private:
+    ////////////////////
+    struct entry
+    {
+        Key key;
+        Value value;
+        std::size_t size;
+    };
+
+    std::list<entry> list_;
+    std::unordered_map<Key, typename std::list<entry>::iterator, Hash> map_;
+
+    std::size_t budget_;
+    cache::stats stats_;
+
+    void evict()
+    {
+        auto& last = list_.back();
+        stats_.size -= last.size;
+
+        map_.erase(last.key);
+        list_.pop_back();
+
+        stats_.entries = list_.size();
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -11,9 +11,12 @@
 #include "framebuf.hpp"
 #include "logging.hpp"
 
+#include <algorithm> // std::min
+#include <cerrno>
 #include <filesystem>
 #include <span>
 #include <stdexcept>
+#include <string_view>
 
 #include <fcntl.h> // open
 #include <xf86drm.h>
@@ -64,6 +67,37 @@ mode get_mode(const connector& conn, unsigned n)
     };
 }
 
+// highest refresh rate mode with the same size as the preferred (or first) mode
+unsigned fastest_mode(const connector& conn)
+{
+    unsigned n = 0;
+    for (auto i = 0; i < conn->count_modes; ++i)
+        if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED) { n = i; break; }
+
+    auto& pref = conn->modes[n];
+    for (auto i = 0; i < conn->count_modes; ++i)
+    {
+        auto& m = conn->modes[i];
+        if (m.hdisplay == pref.hdisplay && m.vdisplay == pref.vdisplay && m.vrefresh > conn->modes[n].vrefresh) n = i;
+    }
+    return n;
+}
+
+// duration of one frame
+clock::duration get_period(const drmModeModeInfo& m)
+{
+    if (!m.clock) return {};
+    return std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds{std::int64_t{m.htotal} * m.vtotal * 1'000'000 / m.clock});
+}
+
+// vblank request type for given crtc index
+auto vblank_type(unsigned type, unsigned pipe)
+{
+    if (pipe > 1) type |= (pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+    else if (pipe == 1) type |= DRM_VBLANK_SECONDARY;
+    return static_cast<drmVBlankSeqType>(type);
+}
+
 auto get_name(const connector& conn)
 {
     static constexpr const char* types[] =
@@ -132,6 +166,53 @@ auto find_crtc(asio::posix::stream_descriptor& fd, const resources& ress, const
     throw std::runtime_error{"Suitable encoder+crtc combo not found"};
 }
 
+auto find_plane(asio::posix::stream_descriptor& fd, const resources& ress, std::uint32_t crtc_id)
+{
+    drm::plane plane;
+
+    auto dev = fd.native_handle();
+    if (drmSetClientCap(dev, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) || drmSetClientCap(dev, DRM_CLIENT_CAP_ATOMIC, 1)) return plane;
+
+    int index = 0;
+    while (index < ress->count_crtcs && ress->crtcs[index] != crtc_id) ++index;
+
+    std::unique_ptr<drmModePlaneRes, void(*)(drmModePlaneRes*)> planes{drmModeGetPlaneResources(dev), &drmModeFreePlaneResources};
+    if (planes) for (auto plane_id : std::span(planes->planes, planes->count_planes))
+    {
+        std::unique_ptr<drmModePlane, void(*)(drmModePlane*)> pl{drmModeGetPlane(dev, plane_id), &drmModeFreePlane};
+        if (!pl || !(pl->possible_crtcs & (1 << index))) continue;
+
+        std::unique_ptr<drmModeObjectProperties, void(*)(drmModeObjectProperties*)> props{
+            drmModeObjectGetProperties(dev, plane_id, DRM_MODE_OBJECT_PLANE), &drmModeFreeObjectProperties
+        };
+        if (!props) continue;
+
+        bool primary = false;
+        drm::plane found{ .id = plane_id };
+
+        for (std::uint32_t n = 0; n < props->count_props; ++n)
+        {
+            std::unique_ptr<drmModePropertyRes, void(*)(drmModePropertyRes*)> prop{drmModeGetProperty(dev, props->props[n]), &drmModeFreeProperty};
+            if (!prop) continue;
+
+            std::string_view name = prop->name;
+            if (name == "type") primary = (props->prop_values[n] == DRM_PLANE_TYPE_PRIMARY);
+            else if (name == "FB_ID") found.fb_id = prop->prop_id;
+            else if (name == "FB_DAMAGE_CLIPS") found.damage_clips = prop->prop_id;
+            else if (name == "SRC_Y") found.src_y = prop->prop_id;
+        }
+
+        if (primary)
+        {
+            if (found.fb_id && found.damage_clips) plane = found;
+            break;
+        }
+    }
+
+    if (!plane.id) drmSetClientCap(dev, DRM_CLIENT_CAP_ATOMIC, 0);
+    return plane;
+}
+
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -146,10 +227,10 @@ num find()
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-device::device(const asio::any_io_executor& ex, drm::num num) : fd_{open(ex, num)},
+device::device(const asio::any_io_executor& ex, drm::num num, bool latency) : fd_{open(ex, num)},
     ress_{get_resources(fd_)},
-    conn_{find_connector(fd_, ress_)}, mode_{get_mode(conn_, 0)},
-    crtc_{fd_, ress_, conn_}
+    conn_{find_connector(fd_, ress_)}, mode_{get_mode(conn_, latency ? fastest_mode(conn_) : 0)},
+    crtc_{fd_, ress_, conn_}, plane_{find_plane(fd_, ress_, crtc_.dev->crtc_id)}
 {
     std::string size;
     if (conn_->mmWidth && conn_->mmHeight)
@@ -162,8 +243,20 @@ device::device(const asio::any_io_executor& ex, drm::num num) : fd_{open(ex, num
     }
 
     info() << "Screen info: " << mode_.width << "x" << mode_.height << "@" << mode_.rate << "hz, " << size << "DPI=" << mode_.dpi;
+    info() << "Damage reporting: " << (plane_.id ? "atomic FB_DAMAGE_CLIPS" : "drmModeDirtyFB");
+
+    while (pipe_ < static_cast<unsigned>(ress_->count_crtcs) && ress_->crtcs[pipe_] != crtc_.dev->crtc_id) ++pipe_;
+    period_ = get_period(conn_->modes[mode_.idx]);
+
+    std::uint64_t val;
+    if (latency)
+    {
+        async_flip_ = !drmGetCap(fd_.native_handle(), DRM_CAP_ASYNC_PAGE_FLIP, &val) && val;
+        info() << "Low latency: async page flips " << (async_flip_ ? "supported" : "not supported");
+    }
 
-    sched_vblank_wait();
+    if (!drmGetCap(fd_.native_handle(), DRM_CAP_CURSOR_WIDTH, &val)) cursor_size_.width = val;
+    if (!drmGetCap(fd_.native_handle(), DRM_CAP_CURSOR_HEIGHT, &val)) cursor_size_.height = val;
 }
 
 void device::acquire_master()
@@ -180,27 +273,159 @@ void device::drop_master()
     drm_control(fd_, drop_master);
 }
 
+bool device::flush(framebuf& fb, std::span<const pixman::box> clips)
+{
+    auto dev = fd_.native_handle();
+    clips = clips.first(std::min(clips.size(), max_clips));
+
+    if (plane_.id)
+    {
+        std::uint32_t blob;
+        if (!drmModeCreatePropertyBlob(dev, clips.data(), clips.size_bytes(), &blob))
+        {
+            std::unique_ptr<drmModeAtomicReq, void(*)(drmModeAtomicReq*)> req{drmModeAtomicAlloc(), &drmModeAtomicFree};
+            drmModeAtomicAddProperty(&*req, plane_.id, plane_.fb_id, fb.id());
+            drmModeAtomicAddProperty(&*req, plane_.id, plane_.damage_clips, blob);
+            // scanout offset of a panned buffer goes along (16.16 fixed point)
+            if (plane_.src_y) drmModeAtomicAddProperty(&*req, plane_.id, plane_.src_y, std::uint64_t{fb.top()} << 16);
+
+            auto code = drmModeAtomicCommit(dev, &*req, DRM_MODE_ATOMIC_NONBLOCK, nullptr);
+            drmModeDestroyPropertyBlob(dev, blob);
+
+            if (!code) return true;
+            if (code == -EBUSY) return false;
+        }
+
+        err() << "Atomic damage reporting failed - falling back to drmModeDirtyFB";
+        plane_.id = 0;
+        if (plane_.src_y) crtc_.pan(fb, conn_->modes[mode_.idx]); // wasn't applied
+    }
+
+    if (dirty_fb_)
+    {
+        drmModeClip rects[max_clips];
+        for (std::size_t n = 0; n < clips.size(); ++n)
+            rects[n] = drmModeClip{
+                static_cast<std::uint16_t>(clips[n].x1), static_cast<std::uint16_t>(clips[n].y1),
+                static_cast<std::uint16_t>(clips[n].x2), static_cast<std::uint16_t>(clips[n].y2)
+            };
+
+        auto code = drmModeDirtyFB(dev, fb.id(), rects, clips.size());
+        if (code == -ENOSYS) dirty_fb_ = false; // driver scans out directly
+        else if (code) throw posix_error{"drmModeDirtyFB"};
+    }
+
+    return true;
+}
+
+void device::flip(framebuf& fb)
+{
+    auto dev = fd_.native_handle();
+    auto crtc_id = crtc_.dev->crtc_id;
+
+    int code = -1;
+    if (async_flip_)
+    {
+        code = drmModePageFlip(dev, crtc_id, fb.id(), DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_PAGE_FLIP_ASYNC, this);
+        // driver may still refuse, eg, if the flip would change more than the fb
+        if (code)
+        {
+            info() << "Async page flip failed - disabling";
+            async_flip_ = false;
+        }
+    }
+    if (code) code = drmModePageFlip(dev, crtc_id, fb.id(), DRM_MODE_PAGE_FLIP_EVENT, this);
+    if (code) throw posix_error{"drmModePageFlip"};
+
+    flip_pending_ = true;
+    wait_events();
+}
+
+bool device::set_cursor(framebuf* sprite)
+{
+    auto crtc_id = crtc_.dev->crtc_id;
+    auto code = sprite
+        ? drmModeSetCursor2(fd_.native_handle(), crtc_id, sprite->handle(), cursor_size_.width, cursor_size_.height, 0, 0)
+        : drmModeSetCursor(fd_.native_handle(), crtc_id, 0, 0, 0);
+    return !code;
+}
+
+bool device::move_cursor(int x, int y)
+{
+    return !drmModeMoveCursor(fd_.native_handle(), crtc_.dev->crtc_id, x, y);
+}
+
 void device::sched_vblank_wait()
 {
     drmVBlank vbl{ .request = {
-        .type = static_cast<drmVBlankSeqType>(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT | DRM_VBLANK_NEXTONMISS),
-        .sequence = 1
+        .type = vblank_type(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT | DRM_VBLANK_NEXTONMISS, pipe_),
+        .sequence = 1,
+        .signal = reinterpret_cast<unsigned long>(this)
     }};
     auto code = drmWaitVBlank(fd_.native_handle(), &vbl);
-    if (code) throw posix_error{"drmModeSetCrtc"};
+    if (code) throw posix_error{"drmWaitVBlank"};
+
+    vblank_armed_ = true;
+    wait_events();
+}
+
+void device::record_vblank(unsigned sequence, unsigned sec, unsigned usec)
+{
+    vblank_.sequence = sequence;
+    vblank_.time = clock::time_point{std::chrono::seconds{sec} + std::chrono::microseconds{usec}};
+}
+
+std::optional<clock::time_point> device::next_vblank(clock::time_point t)
+{
+    using namespace std::chrono_literals;
+    if (!period_.count()) return {};
+
+    // extrapolating too far accumulates error => ask for a fresh timestamp
+    if (t - vblank_.time > 1s)
+    {
+        drmVBlank vbl{ .request = {
+            .type = vblank_type(DRM_VBLANK_RELATIVE, pipe_),
+            .sequence = 0
+        }};
+        if (drmWaitVBlank(fd_.native_handle(), &vbl)) return {};
+
+        record_vblank(vbl.reply.sequence, vbl.reply.tval_sec, vbl.reply.tval_usec);
+    }
+
+    auto n = t >= vblank_.time ? (t - vblank_.time) / period_ + 1 : 0;
+    return vblank_.time + n * period_;
+}
+
+void device::wait_events()
+{
+    if (waiting_) return;
+    waiting_ = true;
 
     static drmEventContext ctx{
-        .version = DRM_EVENT_CONTEXT_VERSION
+        .version = DRM_EVENT_CONTEXT_VERSION,
+        .vblank_handler = [](int, unsigned seq, unsigned sec, unsigned usec, void* data)
+        {
+            auto dev = static_cast<device*>(data);
+            dev->record_vblank(seq, sec, usec);
+            dev->vblank_armed_ = false;
+            if (dev->vblank_cb_) dev->vblank_cb_();
+        },
+        .page_flip_handler = [](int, unsigned seq, unsigned sec, unsigned usec, void* data)
+        {
+            auto dev = static_cast<device*>(data);
+            dev->record_vblank(seq, sec, usec);
+            dev->flip_pending_ = false;
+            if (dev->flipped_cb_) dev->flipped_cb_();
+        },
     };
 
     fd_.async_wait(fd_.wait_read, [&](std::error_code ec)
     {
+        waiting_ = false;
         if (!ec)
         {
             drmHandleEvent(fd_.native_handle(), &ctx);
-            if (vblank_cb_) vblank_cb_();
-
-            sched_vblank_wait();
+            if (flip_pending_ || vblank_armed_) wait_events();
         }
     });
 }
@@ -228,7 +453,12 @@ device::crtc::~crtc()
 void device::crtc::set(framebuf& fb, drmModeModeInfo& mode)
 {
     info() << "Setting up crtc";
-    auto code = drmModeSetCrtc(fd.native_handle(), dev->crtc_id, fb.id(), 0, 0, conns.data(), conns.size(), &mode);
+    pan(fb, mode);
+}
+
+void device::crtc::pan(framebuf& fb, drmModeModeInfo& mode)
+{
+    auto code = drmModeSetCrtc(fd.native_handle(), dev->crtc_id, fb.id(), 0, fb.top(), conns.data(), conns.size(), &mode);
     if (code) throw posix_error{"drmModeSetCrtc"};
 }
 
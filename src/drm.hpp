@@ -7,11 +7,16 @@
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 
+#include "pixman.hpp"
+
 #include <asio/any_io_executor.hpp>
 #include <asio/posix/stream_descriptor.hpp>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
+#include <span>
 #include <vector>
 
 #include <xf86drmMode.h>
@@ -34,6 +39,20 @@ struct mode
     unsigned dpi = 96;
 };
 
+// primary plane and its properties for atomic damage reporting
+struct plane
+{
+    std::uint32_t id = 0;
+    std::uint32_t fb_id = 0, damage_clips = 0;
+    std::uint32_t src_y = 0; // 0 => pan via drmModeSetCrtc
+};
+
+// max number of damage clips per commit
+constexpr std::size_t max_clips = 16;
+
+// vblank timestamps are CLOCK_MONOTONIC
+using clock = std::chrono::steady_clock;
+
 class framebuf;
 
 using resources = std::unique_ptr<drmModeRes, void(*)(drmModeRes*)>;
@@ -45,7 +64,8 @@ class device
 {
 public:
     ////////////////////
-    device(const asio::any_io_executor&, num);
+    // latency => prefer the highest refresh rate and flip without waiting for vblank
+    device(const asio::any_io_executor&, num, bool latency = false);
 
     constexpr auto& mode() const noexcept { return mode_; }
 
@@ -53,9 +73,39 @@ public:
     void drop_master();
 
     void set_output(framebuf& fb) { crtc_.set(fb, conn_->modes[mode_.idx]); }
+    // move scanout to the current top of a multi-page framebuf; with atomic
+    // damage reporting, this is deferred to the next flush()
+    void pan(framebuf& fb) { if (!plane_.id || !plane_.src_y) crtc_.pan(fb, conn_->modes[mode_.idx]); }
+
+    // hardware cursor; sprite is an a8r8g8b8 framebuf of cursor_size()
+    // (nullptr hides it); returns false if the device has no cursor plane
+    struct size { unsigned width, height; };
+    constexpr auto& cursor_size() const noexcept { return cursor_size_; }
+
+    bool set_cursor(framebuf* sprite);
+    bool move_cursor(int x, int y);
 
+    // tell the device which areas of the framebuf changed; returns false
+    // if the device is busy and the same damage should be flushed later
+    bool flush(framebuf&, std::span<const pixman::box> clips);
+
+    // call cb on the next vblank after request_vblank(); waits are one-shot,
+    // so that an idle terminal doesn't wake up every frame
     using vblank_callback = std::function<void()>;
     void on_vblank(vblank_callback cb) { vblank_cb_ = std::move(cb); }
+    void request_vblank() { if (!vblank_armed_) sched_vblank_wait(); }
+
+    // predicted time of the first vblank after t; extrapolated from the last
+    // vblank or flip event (or queried from the kernel, if it's been a while)
+    std::optional<clock::time_point> next_vblank(clock::time_point t);
+    constexpr auto frame_period() const noexcept { return period_; }
+
+    // show fb from the next vblank on; completion is reported via on_flipped()
+    void flip(framebuf&);
+    constexpr bool flip_pending() const noexcept { return flip_pending_; }
+
+    using flipped_callback = std::function<void()>;
+    void on_flipped(flipped_callback cb) { flipped_cb_ = std::move(cb); }
 
 private:
     ////////////////////
@@ -69,6 +119,7 @@ private:
         ~crtc();
 
         void set(framebuf&, drmModeModeInfo&);
+        void pan(framebuf&, drmModeModeInfo&);
     };
 
     ////////////////////
@@ -79,9 +130,26 @@ private:
     drm::mode mode_;
     crtc crtc_;
 
+    drm::plane plane_; // id == 0 => use drmModeDirtyFB
+    size cursor_size_{64, 64};
+    bool dirty_fb_ = true; // drmModeDirtyFB is supported
+
     vblank_callback vblank_cb_;
+    bool vblank_armed_ = false;
     void sched_vblank_wait();
 
+    unsigned pipe_ = 0; // crtc index for vblank requests
+    clock::duration period_{};
+    struct { unsigned sequence = 0; clock::time_point time; } vblank_; // last one seen
+    void record_vblank(unsigned sequence, unsigned sec, unsigned usec);
+
+    bool flip_pending_ = false;
+    bool async_flip_ = false; // DRM_MODE_PAGE_FLIP_ASYNC
+    flipped_callback flipped_cb_;
+
+    bool waiting_ = false;
+    void wait_events();
+
     friend class framebuf;
 };
 
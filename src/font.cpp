@@ -0,0 +1,256 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "alloc.hpp"
+#include "font.hpp"
+
+#include <algorithm> // std::find_if
+#include <cstring> // std::memcmp, std::memcpy
+#include <functional>
+#include <optional>
+#include <string_view>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace font
+{
+
+namespace
+{
+
+// any ink at or to the right of column x
+bool has_ink(const pixman::gray& mask, unsigned x)
+{
+    auto data = mask.data<const std::uint8_t*>();
+    for (unsigned y = 0; y < mask.height(); ++y, data += mask.stride())
+        for (auto col = x; col < mask.width(); ++col)
+            if (data[col]) return true;
+    return false;
+}
+
+auto to_glyph(const vte::cell& cell)
+{
+    font::glyph glyph;
+    std::memcpy(glyph.chars, cell.chars, cell.len);
+    glyph.len = cell.len;
+    glyph.width = cell.width;
+    glyph.style = to_style(cell.attrs);
+    return glyph;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool operator==(const glyph& x, const glyph& y) noexcept
+{
+    return x.len == y.len && x.width == y.width && x.style == y.style && !std::memcmp(x.chars, y.chars, x.len);
+}
+
+std::size_t glyph_hash::operator()(const glyph& glyph) const noexcept
+{
+    auto hash = std::hash<std::string_view>{}(std::string_view{glyph.chars, glyph.len});
+    return hash ^ (glyph.style << 8 | glyph.width);
+}
+
+bool operator==(const tile& x, const tile& y) noexcept
+{
+    return x.fg == y.fg && x.bg == y.bg && x.glyph == y.glyph;
+}
+
+std::size_t tile_hash::operator()(const tile& tile) const noexcept
+{
+    auto hash = glyph_hash{}(tile.glyph);
+    return hash ^ (std::size_t{tile.fg} * 0x9e3779b97f4a7c15) ^ (std::size_t{tile.bg} << 7);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void engine::render(pixman::image& image, int x, int y, std::span<const vte::cell> cells)
+{
+    alloc::scope scope{alloc::render};
+
+    auto h = box_.height;
+    clip_ = pixman::box{x, y, x + static_cast<int>(box_.width * cells.size()), y + static_cast<int>(h)};
+
+    // render background
+    int bx = x;
+    unsigned w = 0;
+
+    auto from = cells.begin();
+    auto fbg = from->bg;
+
+    for (auto to = from; to < cells.end(); to += to->width)
+    {
+        auto tbg = to->bg;
+        if (tbg != fbg)
+        {
+            image.fill(bx, y, w, h, fbg);
+
+            from = to; fbg = tbg;
+            bx += w; w = 0;
+        }
+
+        w += box_.width * to->width;
+    }
+    image.fill(bx, y, w, h, fbg);
+
+    // render text
+    render_text(image, x, y, cells);
+}
+
+void engine::render_text(pixman::image& image, int x, int y, std::span<const vte::cell> cells)
+{
+    render_cells(image, x, y, cells);
+}
+
+void engine::render_cells(pixman::image& image, int x, int y, std::span<const vte::cell> cells)
+{
+    // unless we're at the start, something to the left may already overhang into us
+    bool spill = x > clip_.x1;
+
+    for (auto to = cells.begin(); to < cells.end(); to += to->width)
+    {
+        spill = !is_blank(*to) && render(image, x, y, *to, spill);
+        x += box_.width * to->width;
+    }
+}
+
+void engine::cache_tiles(std::size_t budget)
+{
+    tiles_.emplace(budget / 2);
+    ascii_tiles_.resize(num_styles * 128);
+    ascii_tile_budget_ = budget - budget / 2;
+}
+
+cache::stats engine::tile_stats() const noexcept
+{
+    if (!tiles_) return {};
+
+    auto stats = tiles_->stats();
+    stats.hits += ascii_tile_stats_.hits;
+    stats.misses += ascii_tile_stats_.misses;
+    stats.entries += ascii_tile_stats_.entries;
+    stats.size += ascii_tile_stats_.size;
+    return stats;
+}
+
+bool engine::render(pixman::image& image, int x, int y, const vte::cell& cell, bool spill)
+{
+    auto ascii = is_ascii(cell);
+    auto fg = pixman::to_pixel(cell.fg), bg = pixman::to_pixel(cell.bg);
+
+    // tiles are made (and used) only where nothing else overlaps the cell;
+    // plain ascii ones are looked up by index, without hashing
+    std::optional<font::tile> key;
+    tile_slot* slot = nullptr;
+    if (tiles_ && !spill)
+    {
+        if (ascii)
+        {
+            slot = &ascii_tiles_[to_style(cell.attrs) * 128 + cell.cp];
+            for (auto& tile : slot->tiles)
+                if (tile.image && tile.fg == fg && tile.bg == bg)
+                {
+                    ++ascii_tile_stats_.hits;
+                    image.fill(x, y, *tile.image);
+                    return false;
+                }
+            ++ascii_tile_stats_.misses;
+        }
+        else
+        {
+            key = font::tile{to_glyph(cell), fg, bg};
+            if (auto tile = tiles_->find(*key))
+            {
+                image.fill(x, y, *tile);
+                return false;
+            }
+        }
+    }
+
+    const font::mask* mask;
+    if (ascii)
+    {
+        auto& entry = ascii_[to_style(cell.attrs) * 128 + cell.cp];
+        if (entry) ++ascii_hits_;
+        else
+        {
+            ++ascii_misses_;
+            entry = create_mask(cell);
+
+            ascii_size_ += entry->gray.stride() * entry->gray.height();
+            ++ascii_entries_;
+        }
+        mask = &*entry;
+    }
+    else
+    {
+        auto glyph = key ? key->glyph : to_glyph(cell);
+        mask = glyphs_.find(glyph);
+        if (!mask)
+        {
+            auto new_mask = create_mask(cell);
+            auto size = new_mask.gray.stride() * new_mask.gray.height();
+            mask = &glyphs_.insert(glyph, std::move(new_mask), size);
+        }
+    }
+
+    image.alpha_blend(x, y, mask->gray, cell.fg, clip_);
+
+    unsigned w = box_.width * cell.width, h = box_.height;
+    if (mask->overhang || x + w > image.width() || y + h > image.height()) return mask->overhang;
+
+    if (slot)
+    {
+        // take a free way if there is one, or recycle the next one in turn
+        auto it = std::find_if(std::begin(slot->tiles), std::end(slot->tiles), [](auto& tile){ return !tile.image; });
+        auto& tile = it != std::end(slot->tiles) ? *it : slot->tiles[slot->next++ % tile_slot::ways];
+
+        if (!tile.image && ascii_tile_stats_.size + w * h * sizeof(std::uint32_t) <= ascii_tile_budget_)
+        {
+            tile.image.emplace(w, h);
+            ascii_tile_stats_.size += tile.image->stride() * h;
+            ++ascii_tile_stats_.entries;
+        }
+        if (tile.image)
+        {
+            tile.image->fill(0, 0, image, x, y, w, h);
+            tile.fg = fg;
+            tile.bg = bg;
+        }
+    }
+    else if (key)
+    {
+        pixman::image tile{w, h};
+        tile.fill(0, 0, image, x, y, w, h);
+        auto size = tile.stride() * h;
+        tiles_->insert(*key, std::move(tile), size);
+    }
+
+    return mask->overhang;
+}
+
+font::mask engine::create_mask(const vte::cell& cell)
+{
+    std::optional<pixman::gray> gray;
+    if (auto cp = to_code_point(cell)) gray = draw_procedural(*cp, box_.width * cell.width, box_.height, cell.attrs);
+    if (!gray) gray = rasterize(cell);
+
+    auto overhang = has_ink(*gray, box_.width * cell.width);
+    return font::mask{std::move(*gray), overhang};
+}
+
+cache::stats engine::glyph_stats() const noexcept
+{
+    auto stats = glyphs_.stats();
+    stats.hits += ascii_hits_;
+    stats.misses += ascii_misses_;
+    stats.entries += ascii_entries_;
+    stats.size += ascii_size_;
+    return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,170 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "cache.hpp"
+#include "pixman.hpp"
+#include "vte.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace font
+{
+
+struct box
+{
+    unsigned width, height;
+    int baseline;
+};
+
+// combinations of bold, italic, strike and underline
+constexpr unsigned num_styles = 2 * 2 * 2 * 4;
+
+constexpr unsigned to_style(const vte::attrs& attrs) noexcept
+{
+    return attrs.bold | (attrs.italic << 1) | (attrs.strike << 2) | (attrs.underline << 3);
+}
+
+inline bool is_blank(const vte::cell& cell)
+{
+    return !cell.len || cell.chars[0] == ' ' || cell.attrs.conceal;
+}
+
+// code point of cluster consisting of a single one
+inline std::optional<char32_t> to_code_point(const vte::cell& cell)
+{
+    return cell.cp ? std::optional{cell.cp} : std::nullopt;
+}
+
+inline bool is_ascii(const vte::cell& cell) { return cell.cp && cell.cp < 0x80 && cell.width == 1; }
+
+// box-drawing characters, block elements and braille patterns
+constexpr bool is_procedural(char32_t cp) noexcept
+{
+    return (cp >= 0x2500 && cp <= 0x259f) || (cp >= 0x2800 && cp <= 0x28ff);
+}
+
+inline bool is_procedural(const vte::cell& cell)
+{
+    auto cp = to_code_point(cell);
+    return cp && is_procedural(*cp);
+}
+
+// draw procedural character into a w x h mask, so that lines and blocks
+// join seamlessly with the neighbouring cells regardless of the font;
+// underline and strike-through are drawn the same way as for psf fonts
+std::optional<pixman::gray> draw_procedural(char32_t, unsigned w, unsigned h, const vte::attrs&);
+
+// rasterized glyph cache key
+struct glyph
+{
+    char chars[vte::cell::max_chars];
+    unsigned len;
+    unsigned width;
+    unsigned style;
+};
+
+bool operator==(const glyph&, const glyph&) noexcept;
+struct glyph_hash { std::size_t operator()(const glyph&) const noexcept; };
+
+// cached glyph mask; overhang => has ink to the right of its cell(s)
+struct mask
+{
+    pixman::gray gray;
+    bool overhang;
+};
+
+// composited cell tile cache key
+struct tile
+{
+    font::glyph glyph;
+    uint32_t fg, bg;
+};
+
+bool operator==(const tile&, const tile&) noexcept;
+struct tile_hash { std::size_t operator()(const tile&) const noexcept; };
+
+////////////////////////////////////////////////////////////////////////////////
+// renders rows of cells: fills the background and blends cached glyph masks,
+// which are rasterized by the derived engine on a cache miss
+//
+class engine
+{
+public:
+    ////////////////////
+    virtual ~engine() = default;
+
+    constexpr auto& box() const noexcept { return box_; }
+    cache::stats glyph_stats() const noexcept;
+
+    // cache fully composited cells (glyph on its background) up to budget;
+    // only glyphs that stay within their cells are cached
+    void cache_tiles(std::size_t budget);
+    cache::stats tile_stats() const noexcept;
+
+    // render cells in place at (x, y) of the image
+    void render(pixman::image&, int x, int y, std::span<const vte::cell>);
+
+    // memory resource for transient buffers (eg, arena::frame)
+    void scratch(std::pmr::memory_resource* mr) noexcept { scratch_ = mr; }
+
+protected:
+    ////////////////////
+    explicit engine(std::size_t cache_size) : glyphs_{cache_size}, ascii_(num_styles * 128) { }
+
+    font::box box_;
+    pixman::box clip_; // area being rendered
+    std::pmr::memory_resource* scratch_ = std::pmr::get_default_resource();
+
+    virtual void render_text(pixman::image&, int x, int y, std::span<const vte::cell>);
+    void render_cells(pixman::image&, int x, int y, std::span<const vte::cell>);
+
+    virtual pixman::gray rasterize(const vte::cell&) = 0;
+
+private:
+    ////////////////////
+    cache::lru<glyph, font::mask, glyph_hash> glyphs_;
+    std::optional<cache::lru<tile, pixman::image, tile_hash>> tiles_;
+
+    // plain ascii glyphs by style and code point; bypass the glyph cache
+    std::vector<std::optional<font::mask>> ascii_;
+    std::size_t ascii_hits_ = 0, ascii_misses_ = 0;
+    std::size_t ascii_size_ = 0, ascii_entries_ = 0;
+
+    // plain ascii tiles by style and code point, a few colour pairs each;
+    // get half of the tile budget, the rest goes to tiles_
+    struct ascii_tile
+    {
+        std::uint32_t fg, bg;
+        std::optional<pixman::image> image;
+    };
+    struct tile_slot
+    {
+        static constexpr unsigned ways = 4;
+        ascii_tile tiles[ways];
+        unsigned next = 0; // to be replaced once all are taken
+    };
+    std::vector<tile_slot> ascii_tiles_;
+    std::size_t ascii_tile_budget_ = 0;
+    cache::stats ascii_tile_stats_;
+
+    font::mask create_mask(const vte::cell&);
+
+    // returns true if the glyph overhangs into the next cell;
+    // spill => previous glyph overhangs into this one
+    bool render(pixman::image&, int x, int y, const vte::cell&, bool spill);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
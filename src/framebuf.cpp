@@ -10,6 +10,9 @@
 #include "framebuf.hpp"
 #include "logging.hpp"
 
+#include <algorithm> // std::max, std::min
+#include <cstddef> // std::byte
+
 #include <sys/mman.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -18,18 +21,143 @@
 namespace drm
 {
 
+namespace
+{
+
+constexpr auto area(const pixman::box& b) { return std::int64_t{b.x2 - b.x1} * (b.y2 - b.y1); }
+
+constexpr auto unite(const pixman::box& a, const pixman::box& b)
+{
+    return pixman::box{ std::min(a.x1, b.x1), std::min(a.y1, b.y1), std::max(a.x2, b.x2), std::max(a.y2, b.y2) };
+}
+
+// how much more area the union of two boxes covers vs the boxes themselves
+// (overlapping area is counted once)
+constexpr auto waste(const pixman::box& a, const pixman::box& b)
+{
+    pixman::box i{ std::max(a.x1, b.x1), std::max(a.y1, b.y1), std::min(a.x2, b.x2), std::min(a.y2, b.y2) };
+    auto overlap = (i.x1 < i.x2 && i.y1 < i.y2) ? area(i) : 0;
+    return area(unite(a, b)) - (area(a) + area(b) - overlap);
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void damage::add(pixman::box box)
+{
+    // absorb clips that can be merged without covering extra area
+    for (auto it = clips_.begin(); it != clips_.end(); )
+        if (waste(box, *it) <= 0)
+        {
+            box = unite(box, *it);
+            clips_.erase(it);
+            it = clips_.begin();
+        }
+        else ++it;
+
+    clips_.push_back(box);
+
+    // too many clips => merge the pair that wastes the least area
+    while (clips_.size() > max_clips)
+    {
+        auto best = waste(clips_[0], clips_[1]);
+        std::size_t bi = 0, bj = 1;
+
+        for (std::size_t i = 0; i < clips_.size(); ++i)
+            for (auto j = i + 1; j < clips_.size(); ++j)
+                if (auto w = waste(clips_[i], clips_[j]); w < best) best = w, bi = i, bj = j;
+
+        clips_[bi] = unite(clips_[bi], clips_[bj]);
+        clips_.erase(clips_.begin() + bj);
+    }
+}
+
+void damage::add(const damage& other)
+{
+    for (auto& box : other.clips_) add(box);
+}
+
+void damage::move(int dx, int dy, const pixman::box& clip)
+{
+    for (auto it = clips_.begin(); it != clips_.end(); )
+    {
+        pixman::box box{
+            std::max(it->x1 + dx, clip.x1), std::max(it->y1 + dy, clip.y1),
+            std::min(it->x2 + dx, clip.x2), std::min(it->y2 + dy, clip.y2)
+        };
+        if (box.x1 < box.x2 && box.y1 < box.y2)
+        {
+            *it = box;
+            ++it;
+        }
+        else it = clips_.erase(it);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
-framebuf::framebuf(device& dev, unsigned w, unsigned h) : drm_{dev.fd_},
-    buf_{drm_, w, h}, fbo_{drm_, w, h, buf_}, map_{drm_, buf_},
-    image_{w, h, buf_.stride, map_.data}
+framebuf::framebuf(device& dev, unsigned w, unsigned h, unsigned pages) : dev_{dev}, drm_{dev.fd_},
+    buf_{drm_, w, h * pages}, fbo_{drm_, w, h * pages, buf_}, map_{drm_, buf_},
+    height_{h}, total_{h * pages},
+    full_{w, total_, buf_.stride, map_.data}, image_{view(0)}
 {
     info() << "Using framebuf: " << image_.depth << "-bit color, " << image_.bits_per_pixel <<  " bpp, stride=" << buf_.stride << ", size=" << buf_.size;
 }
 
+pixman::image framebuf::view(int top)
+{
+    return pixman::image{full_.width(), height_, buf_.stride, static_cast<std::byte*>(map_.data) + top * buf_.stride};
+}
+
+void framebuf::damage(int x, int y, unsigned w, unsigned h)
+{
+    pixman::box box{
+        std::max(x, 0), std::max(y, 0),
+        std::min<int>(x + w, image_.width()), std::min<int>(y + h, image_.height())
+    };
+    if (box.x1 < box.x2 && box.y1 < box.y2) damage_.add(pixman::box{box.x1, box.y1 + top_, box.x2, box.y2 + top_});
+}
+
+void framebuf::damage(const drm::damage& other)
+{
+    for (auto& box : other.clips()) damage(box.x1, box.y1, box.x2 - box.x1, box.y2 - box.y1);
+}
+
+void framebuf::scroll(int dy, const pixman::image* src)
+{
+    int height = height_, total = total_;
+    if (dy <= -height || dy >= height) return;
+
+    if (auto top = top_ - dy; top >= 0 && top + height <= total)
+    {
+        top_ = top;
+        image_ = view(top_);
+    }
+    else
+    {
+        // content moves up => window goes down => restart from the top, and vice versa
+        int to = (dy < 0) ? 0 : total - height;
+        if (src)
+        {
+            top_ = to;
+            image_ = view(top_);
+            image_.stream(*src, pixman::box{0, 0, static_cast<int>(image_.width()), height});
+        }
+        else
+        {
+            // rows that stay visible
+            int y0 = std::max(-dy, 0), y1 = std::min(height - dy, height);
+            full_.move(pixman::box{0, top_ + y0, static_cast<int>(full_.width()), top_ + y1}, 0, to - top_ + dy);
+
+            top_ = to;
+            image_ = view(top_);
+        }
+        damage(0, 0, image_.width(), height);
+    }
+}
+
 void framebuf::commit()
 {
-    auto code = drmModeDirtyFB(drm_.native_handle(), fbo_.id, nullptr, 0);
-    if (code) throw posix_error{"drmModeDirtyFB"};
+    if (!damage_.empty() && dev_.flush(*this, damage_.clips())) damage_.clear();
 }
 
 framebuf::scoped_dumbuf::scoped_dumbuf(asio::posix::stream_descriptor& drm, unsigned w, unsigned h) : drm{drm}
@@ -12,22 +12,65 @@
 
 #include <asio/posix/stream_descriptor.hpp>
 #include <cstdint>
+#include <span>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 namespace drm
 {
 
+////////////////////////////////////////////////////////////////////////////////
+// set of damaged rectangles, merged down to at most max_clips
+//
+class damage
+{
+public:
+    ////////////////////
+    void add(pixman::box);
+    void add(const damage&);
+
+    // shift clips by dx, dy and clip them to the box
+    void move(int dx, int dy, const pixman::box& clip);
+
+    auto clips() const noexcept { return std::span{clips_}; }
+
+    bool empty() const noexcept { return clips_.empty(); }
+    void clear() noexcept { clips_.clear(); }
+
+private:
+    ////////////////////
+    std::vector<pixman::box> clips_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 class framebuf
 {
 public:
     ////////////////////
-    explicit framebuf(device&, unsigned w, unsigned h);
+    // pages > 1 makes the buffer that many times taller than the visible area
+    // so that it can be scrolled by panning, see scroll()
+    explicit framebuf(device&, unsigned w, unsigned h, unsigned pages = 1);
 
     constexpr auto id() const noexcept { return fbo_.id; }
-    auto& image() noexcept { return image_; }
-
+    constexpr auto handle() const noexcept { return buf_.handle; }
+    auto& image() noexcept { return image_; } // visible area
+
+    // scanout offset of the visible area within the buffer
+    constexpr unsigned top() const noexcept { return top_; }
+
+    // move contents of the visible area by dy rows by sliding it over the
+    // buffer in the opposite direction; once it runs into either end, it
+    // wraps to the other one and its contents are restored from src (if
+    // given) or moved over within the buffer
+    //
+    // NB: call device::pan() afterwards to update the scanout
+    void scroll(int dy, const pixman::image* src = nullptr);
+
+    // mark area as changed; nothing is sent to the device until commit()
+    void damage(int x, int y, unsigned w, unsigned h);
+    void damage(const drm::damage&);
     void commit();
+    bool pending() const noexcept { return !damage_.empty(); } // not yet taken by the device
 
 private:
     ////////////////////
@@ -61,13 +104,21 @@ private:
     };
 
     ////////////////////
+    device& dev_;
     asio::posix::stream_descriptor& drm_;
 
     scoped_dumbuf buf_;
     scoped_fbo fbo_;
     scoped_mapped_ptr map_;
 
+    unsigned height_, total_;
+    int top_ = 0;
+
+    pixman::image full_; // whole buffer
     pixman::image image_;
+    drm::damage damage_; // in buffer coordinates
+
+    pixman::image view(int top);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,120 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "ft.hpp"
+#include "logging.hpp"
+#include "vte.hpp"
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace ft
+{
+
+namespace
+{
+
+auto load_face(FT_Library lib, PangoFont* font)
+{
+    face_ptr face{nullptr, &FT_Done_Face};
+
+    auto pattern = pango_fc_font_get_pattern(PANGO_FC_FONT(font));
+
+    FcChar8* file;
+    int index = 0;
+    double size;
+    if (FcPatternGetString(pattern, FC_FILE, 0, &file) != FcResultMatch) return face;
+    if (FcPatternGetDouble(pattern, FC_PIXEL_SIZE, 0, &size) != FcResultMatch) return face;
+    FcPatternGetInteger(pattern, FC_INDEX, 0, &index);
+
+    // synthetic bold or slant => leave it to pango
+    FcBool embolden = false;
+    FcMatrix* matrix = nullptr;
+    FcPatternGetBool(pattern, FC_EMBOLDEN, 0, &embolden);
+    FcPatternGetMatrix(pattern, FC_MATRIX, 0, &matrix);
+    if (embolden || (matrix && (matrix->xx != 1 || matrix->xy != 0 || matrix->yx != 0 || matrix->yy != 1))) return face;
+
+    FT_Face ftf;
+    if (FT_New_Face(lib, reinterpret_cast<const char*>(file), index, &ftf)) return face;
+    face.reset(ftf);
+
+    if (FT_Set_Pixel_Sizes(ftf, 0, size + .5)) face.reset();
+    return face;
+}
+
+void blit(pixman::gray& mask, int x, int y, const FT_Bitmap& bitmap)
+{
+    int w = mask.width(), h = mask.height();
+    auto data = mask.data<std::uint8_t*>();
+
+    for (int row = 0; row < static_cast<int>(bitmap.rows); ++row)
+    {
+        auto my = y + row;
+        if (my < 0 || my >= h) continue;
+
+        auto src = bitmap.buffer + row * bitmap.pitch;
+        auto dst = data + my * mask.stride();
+
+        for (int col = 0; col < static_cast<int>(bitmap.width); ++col)
+        {
+            auto mx = x + col;
+            if (mx < 0 || mx >= w) continue;
+
+            if (bitmap.pixel_mode == FT_PIXEL_MODE_MONO)
+                dst[mx] = (src[col >> 3] & (0x80 >> (col & 7))) ? 0xff : 0;
+            else dst[mx] = src[col];
+        }
+    }
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+engine::engine(std::string_view font_desc, unsigned dpi, std::size_t cache_size, pango::shaping shaping) :
+    pango::engine{font_desc, dpi, cache_size, shaping}
+{
+    if (!face(vte::attrs{})) err() << "FreeType face not usable - falling back to pango";
+}
+
+FT_Face engine::face(const vte::attrs& attrs)
+{
+    auto& face = faces_[attrs.bold | (attrs.italic << 1)];
+    if (!face)
+    {
+        face.emplace(load_face(&*ft_lib_, &*load_font(attrs)));
+        if (*face) info() << "Using FreeType face: " << (*face)->family_name << ", style=" << (*face)->style_name;
+    }
+    return face->get();
+}
+
+pixman::gray engine::rasterize(const vte::cell& cell)
+{
+    // pango takes care of font fallback, complex clusters and decorations
+    auto face = this->face(cell.attrs);
+    if (!face || cell.attrs.underline || cell.attrs.strike) return pango::engine::rasterize(cell);
+
+    auto cp = font::to_code_point(cell);
+    if (!cp) return pango::engine::rasterize(cell);
+
+    auto index = FT_Get_Char_Index(face, *cp);
+    if (!index || FT_Load_Glyph(face, index, FT_LOAD_DEFAULT)) return pango::engine::rasterize(cell);
+
+    auto slot = face->glyph;
+    if (FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL)) return pango::engine::rasterize(cell);
+
+    auto mode = slot->bitmap.pixel_mode;
+    if (mode != FT_PIXEL_MODE_GRAY && mode != FT_PIXEL_MODE_MONO) return pango::engine::rasterize(cell);
+
+    // +1 to allow overhang on the right
+    pixman::gray mask{box_.width * (cell.width + 1), box_.height};
+    blit(mask, slot->bitmap_left, box_.baseline - slot->bitmap_top, slot->bitmap);
+
+    return mask;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
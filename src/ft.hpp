@@ -0,0 +1,45 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "pango.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace ft
+{
+
+using face_ptr = std::unique_ptr<FT_FaceRec_, FT_Error(*)(FT_Face)>;
+
+////////////////////////////////////////////////////////////////////////////////
+// renders glyphs straight from the resolved FT_Face and falls back
+// to pango for clusters (or styles) it cannot handle
+//
+class engine : public pango::engine
+{
+public:
+    ////////////////////
+    // runs shaped as a whole (per_run) are still laid out by pango
+    engine(std::string_view font_desc, unsigned dpi, std::size_t cache_size, pango::shaping = pango::per_cell);
+
+private:
+    ////////////////////
+    // regular, bold, italic and bold+italic faces
+    // NB: face_ptr holds nullptr for faces that need pango
+    std::optional<face_ptr> faces_[4];
+    FT_Face face(const vte::attrs&);
+
+    pixman::gray rasterize(const vte::cell&) override;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
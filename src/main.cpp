@@ -41,7 +41,19 @@ try
 
         { "-g", "--gpu", "cardN|N",     "Use specified graphics adapter; if none given, use the first detected." },
         { "-p", "--dpi", "N",           "Override DPI value reported by the screen." },
-        { "-f", "--font", "name",       "Use specified font. Default: '" + options.font + "'\n" },
+        { "-b", "--buffers", "N",       "Number of framebuffers: 1 = draw in place, 2-3 = page flipping. Default: " + std::to_string(options.buffers) },
+        { "-n", "--no-shadow",          "Render straight into the framebuffer, instead of a copy in system memory." },
+        { "-l", "--latency",            "Use the highest refresh rate and show updates right away, even if it causes tearing." },
+        { "-m", "--max-fps", "N",       "Limit frame rate. Default: no limit" },
+        { "-P", "--pan",                "Scroll by panning the display within a double-height framebuffer (implies --buffers 1 and --no-shadow)." },
+        { "-f", "--font", "name",       "Use specified font, or PSF console font file (*.psf[.gz]). Default: '" + options.font + "'" },
+        { "-c", "--glyph-cache", "N",   "Glyph cache size in KiB, per render thread; ASCII glyphs are kept on top of it. Default: " + std::to_string(options.glyph_cache) },
+        { "-T", "--tile-cache", "N",    "Composited cell cache size in KiB; 0 turns it off. Default: " + std::to_string(options.tile_cache) },
+        { "-R", "--row-cache", "N",     "Rendered row cache size in KiB; 0 turns it off. Default: " + std::to_string(options.row_cache) },
+        { "-r", "--shape-runs",         "Shape runs of cells with the same style in one pass, instead of cell by cell." },
+        { "-F", "--freetype",           "Render glyphs directly with FreeType and only fall back to pango when needed." },
+        { "-A", "--alloc-budget", "N",  "Allocations allowed per warm frame before they get reported (ALLOC_STATS builds only). Default: " + std::to_string(options.alloc_budget) },
+        { "-j", "--threads", "N",       "Number of render threads, each with its own font caches; 0 = one per core. Default: " + std::to_string(options.threads) + "\n" },
 
         { "-s", "--speed", "S",         "Change mouse speed. Default: " + std::to_string(options.mouse_speed) + "\n" },
 
@@ -90,9 +102,49 @@ try
         auto dpi = get<unsigned>(args["--dpi"], {}, {}, "DPI value");
         if (dpi) options.dpi = *dpi;
 
+        auto buffers = get<unsigned>(args["--buffers"], {}, {}, "number of buffers");
+        if (buffers)
+        {
+            if (*buffers < 1 || *buffers > 3) throw std::invalid_argument{"Invalid number of buffers - " + std::to_string(*buffers)};
+            options.buffers = *buffers;
+        }
+        options.shadow = !args["--no-shadow"];
+
+        // panning only works in place and without a shadow (which would have
+        // to be moved on every scroll) => --pan implies --buffers 1 --no-shadow
+        options.pan = !!args["--pan"];
+        if (options.pan)
+        {
+            if (buffers && *buffers != 1) throw std::invalid_argument{"--pan requires --buffers 1"};
+            options.buffers = 1;
+            options.shadow = false;
+        }
+
+        options.latency = !!args["--latency"];
+
+        auto max_fps = get<unsigned>(args["--max-fps"], {}, {}, "frame rate");
+        if (max_fps) options.max_fps = *max_fps;
+
         auto font = args["--font"];
         if (font) options.font = font.value();
 
+        auto glyph_cache = get<unsigned>(args["--glyph-cache"], {}, {}, "glyph cache size");
+        if (glyph_cache) options.glyph_cache = *glyph_cache;
+
+        auto tile_cache = get<unsigned>(args["--tile-cache"], {}, {}, "tile cache size");
+        if (tile_cache) options.tile_cache = *tile_cache;
+
+        auto row_cache = get<unsigned>(args["--row-cache"], {}, {}, "row cache size");
+        if (row_cache) options.row_cache = *row_cache;
+        if (args["--shape-runs"]) options.shaping = pango::per_run;
+        options.freetype = !!args["--freetype"];
+
+        auto alloc_budget = get<unsigned>(args["--alloc-budget"], {}, {}, "allocation budget");
+        if (alloc_budget) options.alloc_budget = *alloc_budget;
+
+        auto threads = get<unsigned>(args["--threads"], {}, {}, "number of threads");
+        if (threads) options.threads = *threads;
+
         auto speed = get<float>(args["--speed"], {}, {}, "mouse speed");
         if (speed) options.mouse_speed = *speed;
 
@@ -5,10 +5,13 @@
 // Distributed under the GNU GPL license. See the LICENSE.md file for details.
 
 ////////////////////////////////////////////////////////////////////////////////
+#include "alloc.hpp"
 #include "logging.hpp"
 #include "pango.hpp"
 #include "vte.hpp"
 
+#include <algorithm> // std::upper_bound
+#include <cstring> // std::memset
 #include <stdexcept>
 
 #define pango_pixels PANGO_PIXELS_CEIL
@@ -58,7 +61,7 @@ auto get_box(font_map_ptr& font_map, context_ptr& context, font_desc_ptr& font_d
     font_metrics_ptr metrics{pango_font_get_metrics(&*font, nullptr), &pango_font_metrics_unref};
     if (!metrics) throw std::runtime_error{"Failed to get font metrics"};
 
-    return pango::box{
+    return font::box{
         .width = pango_pixels(pango_font_metrics_get_approximate_char_width(&*metrics)),
         .height = pango_pixels(pango_font_metrics_get_height(&*metrics)),
         .baseline = pango_pixels(pango_layout_get_baseline(&*layout))
@@ -80,65 +83,57 @@ constexpr PangoUnderline to_pango[] =
     PANGO_UNDERLINE_ERROR,
 };
 
-auto create_attrs(const vte::cell& cell)
+auto insert(attrs_ptr& attrs, PangoAttribute* attr)
 {
-    attrs_ptr attrs{pango_attr_list_new(), &pango_attr_list_unref};
-    if (!attrs) throw std::runtime_error{"Failed to create attribute list"};
-
-    if (cell.attrs.bold)
-    {
-        auto attr = pango_attr_weight_new(PANGO_WEIGHT_BOLD);
-        attr->start_index = 0;
-        attr->end_index = cell.max_chars;
-        pango_attr_list_insert(&*attrs, attr);
-    }
+    attr->start_index = PANGO_ATTR_INDEX_FROM_TEXT_BEGINNING;
+    attr->end_index = PANGO_ATTR_INDEX_TO_TEXT_END;
+    pango_attr_list_insert(&*attrs, attr);
+}
 
-    if (cell.attrs.italic)
-    {
-        auto attr = pango_attr_style_new(PANGO_STYLE_ITALIC);
-        attr->start_index = 0;
-        attr->end_index = cell.max_chars;
-        pango_attr_list_insert(&*attrs, attr);
-    }
+auto create_attrs(const vte::attrs& va)
+{
+    alloc::scope scope{alloc::attrs};
 
-    if (cell.attrs.strike)
-    {
-        auto attr = pango_attr_strikethrough_new(true);
-        attr->start_index = 0;
-        attr->end_index = cell.max_chars;
-        pango_attr_list_insert(&*attrs, attr);
-    }
+    attrs_ptr attrs{pango_attr_list_new(), &pango_attr_list_unref};
+    if (!attrs) throw std::runtime_error{"Failed to create attribute list"};
 
-    if (cell.attrs.underline)
-    {
-        auto attr = pango_attr_underline_new(to_pango[cell.attrs.underline]);
-        attr->start_index = 0;
-        attr->end_index = cell.max_chars;
-        pango_attr_list_insert(&*attrs, attr);
-    }
+    if (va.bold) insert(attrs, pango_attr_weight_new(PANGO_WEIGHT_BOLD));
+    if (va.italic) insert(attrs, pango_attr_style_new(PANGO_STYLE_ITALIC));
+    if (va.strike) insert(attrs, pango_attr_strikethrough_new(true));
+    if (va.underline) insert(attrs, pango_attr_underline_new(to_pango[va.underline]));
 
     return attrs;
 }
 
-constexpr bool operator==(const pixman::color& x, const pixman::color& y) noexcept
+constexpr bool operator==(const vte::attrs& x, const vte::attrs& y) noexcept
 {
-    return x.red == y.red && x.green == y.green && x.blue == y.blue && x.alpha == y.alpha;
+    return x.bold == y.bold && x.italic == y.italic && x.strike == y.strike && x.underline == y.underline;
 }
 
-constexpr bool operator==(const vte::attrs& x, const vte::attrs& y) noexcept
+void render_line(pixman::gray& mask, PangoLayoutLine* line, int baseline)
 {
-    return x.bold == y.bold && x.italic == y.italic && x.strike == y.strike && x.underline == y.underline;
+    FT_Bitmap ftb;
+    ftb.rows  = mask.height();
+    ftb.width = mask.width();
+    ftb.pitch = mask.stride();
+    ftb.buffer= mask.data<uint8_t*>();
+    ftb.num_grays = mask.num_colors;
+    ftb.pixel_mode = FT_PIXEL_MODE_GRAY;
+    pango_ft2_render_layout_line(&ftb, line, 0, baseline);
 }
 
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-engine::engine(std::string_view font_desc, unsigned dpi) :
+engine::engine(std::string_view font_desc, unsigned dpi, std::size_t cache_size, pango::shaping shaping) :
+    font::engine{cache_size},
     ft_lib_{create_ft_lib()},
     font_map_{create_font_map(dpi)}, context_{create_context(font_map_)}, font_desc_{create_font_desc(font_desc)},
     layout_{create_layout(context_, font_desc_)},
-    box_{get_box(font_map_, context_, font_desc_, layout_)}
+    shaping_{shaping}
 {
+    box_ = get_box(font_map_, context_, font_desc_, layout_);
+
     auto name = pango_font_description_get_family(&*font_desc_);
     auto style = pango_font_description_get_style(&*font_desc_);
     auto weight = pango_font_description_get_weight(&*font_desc_);
@@ -147,73 +142,149 @@ engine::engine(std::string_view font_desc, unsigned dpi) :
     info() << "Using font: " << name << ", style=" << style << ", weight=" << weight << ", size=" << size << ", box=" << box_.width << "x" << box_.height;
 }
 
-pixman::image engine::render(std::span<const vte::cell> cells)
+void engine::render_text(pixman::image& image, int x, int y, std::span<const vte::cell> cells)
 {
-    unsigned w = box_.width * cells.size(), h = box_.height;
-    pixman::image image{w, h};
+    if (shaping_ == per_cell) return render_cells(image, x, y, cells);
+
+    for (auto from = cells.begin(); from < cells.end(); )
+    {
+        if (font::is_blank(*from) || font::is_procedural(*from))
+        {
+            if (!font::is_blank(*from)) render_cells(image, x, y, std::span{from, from + from->width});
+
+            x += box_.width * from->width;
+            from += from->width;
+            continue;
+        }
 
-    // render background
-    int x = 0, y = 0; w = 0;
+        // collect cells with the same style and color
+        // NB: blanks are kept inside the run, but not at its end;
+        // procedural characters end the run, as they need to fit the grid exactly
+        run_.text.clear();
+        run_.offsets.clear();
+        run_.cols.clear();
 
-    auto from = cells.begin();
-    auto fbg = from->bg;
+        auto end = from;
+        unsigned col = 0, cols = 0;
+        std::size_t count = 0, len = 0;
 
-    for (auto to = from; to < cells.end(); to += to->width)
-    {
-        auto tbg = to->bg;
-        if (tbg != fbg)
+        for (auto to = from; to < cells.end() && !to->attrs.conceal && to->attrs == from->attrs && to->fg == from->fg && !font::is_procedural(*to); to += to->width)
         {
-            image.fill(x, y, w, h, fbg);
+            run_.offsets.push_back(run_.text.size());
+            run_.cols.push_back(col);
 
-            from = to; fbg = tbg;
-            x += w; w = 0;
+            if (to->len)
+                run_.text.append(to->chars, to->len);
+            else run_.text.push_back(' ');
+
+            col += to->width;
+            if (!font::is_blank(*to))
+            {
+                end = to + to->width;
+                cols = col;
+                count = run_.offsets.size();
+                len = run_.text.size();
+            }
         }
+        run_.text.resize(len);
+        run_.offsets.resize(count);
+        run_.cols.resize(count);
 
-        w += box_.width * to->width;
+        std::span run{from, end};
+        if (!render_run(image, x, y, run, cols)) render_cells(image, x, y, run);
+
+        x += box_.width * cols;
+        from = end;
     }
-    image.fill(x, y, w, h, fbg);
+}
 
-    // render text
-    x = 0;
+bool engine::render_run(pixman::image& image, int x, int y, std::span<const vte::cell> run, unsigned cols)
+{
+    pango_layout_set_text(&*layout_, run_.text.data(), run_.text.size());
+    pango_layout_set_attributes(&*layout_, intern(run.front().attrs));
+    auto line = pango_layout_get_line(&*layout_, 0);
 
-    from = cells.begin();
-    auto attrs = create_attrs(*from);
+    // snap each cluster to its cell, by adjusting advance of the glyph before it
+    PangoGlyphInfo* prev = nullptr;
+    int pen = 0;
+    std::ptrdiff_t last = 0;
 
-    for (auto to = from; to < cells.end(); to += to->width)
+    for (auto node = line->runs; node; node = node->next)
     {
-        if (to->len && to->chars[0] != ' ' && !to->attrs.conceal)
+        auto item = static_cast<PangoGlyphItem*>(node->data);
+        auto glyphs = item->glyphs;
+
+        for (auto n = 0; n < glyphs->num_glyphs; ++n)
         {
-            if (to->attrs != from->attrs)
+            auto& glyph = glyphs->glyphs[n];
+            if (glyph.attr.is_cluster_start)
             {
-                from = to;
-                attrs = create_attrs(*from);
+                auto offset = item->item->offset + glyphs->log_clusters[n];
+                auto idx = std::upper_bound(run_.offsets.begin(), run_.offsets.end(), offset) - run_.offsets.begin() - 1;
+
+                // clusters are out of order (eg, RTL text) => let the caller render cell by cell
+                if (idx < last) return false;
+                last = idx;
+
+                int target = run_.cols[idx] * box_.width * PANGO_SCALE;
+                if (prev) prev->geometry.width += target - pen;
+                pen = target;
             }
-            render(image, x, y, *to, attrs);
+            pen += glyph.geometry.width;
+            prev = &glyph;
         }
-        x += box_.width * to->width;
     }
+    if (prev) prev->geometry.width += cols * box_.width * PANGO_SCALE - pen;
 
-    return image;
+    // +1 to allow overhang on the right
+    unsigned w = box_.width * (cols + 1), h = box_.height;
+    std::size_t stride = (w + 3) & ~3u, size = stride * h;
+
+    auto data = scratch_->allocate(size, 4);
+    std::memset(data, 0, size);
+
+    {
+        pixman::gray mask{w, h, stride, data};
+        render_line(mask, line, box_.baseline);
+
+        image.alpha_blend(x, y, mask, run.front().fg, clip_);
+    }
+    scratch_->deallocate(data, size, 4);
+
+    return true;
 }
 
-void engine::render(pixman::image& image, int x, int y, const vte::cell& cell, const attrs_ptr& attrs)
+PangoAttrList* engine::intern(const vte::attrs& attrs)
+{
+    auto& style = styles_[font::to_style(attrs)];
+    if (!style) style.emplace(create_attrs(attrs));
+    return &**style;
+}
+
+font_ptr engine::load_font(const vte::attrs& va)
+{
+    font_desc_ptr desc{pango_font_description_copy(&*font_desc_), &pango_font_description_free};
+    if (!desc) throw std::runtime_error{"Failed to create font description"};
+
+    if (va.bold) pango_font_description_set_weight(&*desc, PANGO_WEIGHT_BOLD);
+    if (va.italic) pango_font_description_set_style(&*desc, PANGO_STYLE_ITALIC);
+
+    font_ptr font{pango_font_map_load_font(&*font_map_, &*context_, &*desc), &g_object_unref};
+    if (!font) throw std::runtime_error{"Failed to load font"};
+    return font;
+}
+
+pixman::gray engine::rasterize(const vte::cell& cell)
 {
     pango_layout_set_text(&*layout_, cell.chars, cell.len);
-    pango_layout_set_attributes(&*layout_, &*attrs);
+    pango_layout_set_attributes(&*layout_, intern(cell.attrs));
     auto symbol = pango_layout_get_line_readonly(&*layout_, 0);
 
     // +1 to allow overhang on the right
     pixman::gray mask{box_.width * (cell.width + 1), box_.height};
-    FT_Bitmap ftb;
-    ftb.rows  = mask.height();
-    ftb.width = mask.width();
-    ftb.pitch = mask.stride();
-    ftb.buffer= mask.data<uint8_t*>();
-    ftb.num_grays = mask.num_colors;
-    ftb.pixel_mode = FT_PIXEL_MODE_GRAY;
-    pango_ft2_render_layout_line(&ftb, symbol, 0, box_.baseline);
+    render_line(mask, symbol, box_.baseline);
 
-    image.alpha_blend(x, y, mask, cell.fg);
+    return mask;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -7,16 +7,20 @@
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 
+#include "font.hpp"
 #include "pixman.hpp"
+#include "vte.hpp"
 
+#include <cstddef>
 #include <memory>
+#include <optional>
 #include <span>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include <pango/pangoft2.h>
 
-namespace vte { struct cell; }
-
 ////////////////////////////////////////////////////////////////////////////////
 namespace pango
 {
@@ -30,24 +34,18 @@ using font_metrics_ptr = std::unique_ptr<PangoFontMetrics, void(*)(PangoFontMetr
 using layout_ptr = std::unique_ptr<PangoLayout, void(*)(void*)>;
 using attrs_ptr = std::unique_ptr<PangoAttrList, void(*)(PangoAttrList*)>;
 
-struct box
-{
-    unsigned width, height;
-    int baseline;
-};
+// shape each cell separately (and cache the result),
+// or whole runs of cells with the same style and color
+enum shaping { per_cell, per_run };
 
 ////////////////////////////////////////////////////////////////////////////////
-class engine
+class engine : public font::engine
 {
 public:
     ////////////////////
-    engine(std::string_view font_desc, unsigned dpi);
+    engine(std::string_view font_desc, unsigned dpi, std::size_t cache_size, pango::shaping = per_cell);
 
-    constexpr auto& box() const noexcept { return box_; }
-
-    pixman::image render(std::span<const vte::cell>);
-
-private:
+protected:
     ////////////////////
     ft_lib_ptr ft_lib_;
     font_map_ptr font_map_;
@@ -55,9 +53,30 @@ private:
     font_desc_ptr font_desc_;
 
     layout_ptr layout_;
-    pango::box box_;
 
-    void render(pixman::image&, int x, int y, const vte::cell&, const attrs_ptr&);
+    // interned attribute list for each combination of bold, italic, strike
+    // and underline; NB: pango still resolves the font for every layout
+    std::optional<attrs_ptr> styles_[font::num_styles];
+    PangoAttrList* intern(const vte::attrs&);
+
+    // font for the base description with bold and/or italic applied
+    font_ptr load_font(const vte::attrs&);
+
+    pixman::gray rasterize(const vte::cell&) override;
+
+private:
+    ////////////////////
+    pango::shaping shaping_;
+    struct
+    {
+        std::string text;
+        std::vector<unsigned> offsets; // byte offset of each cell in text
+        std::vector<unsigned> cols; // column of each cell in the run
+    }
+    run_;
+
+    void render_text(pixman::image&, int x, int y, std::span<const vte::cell>) override;
+    bool render_run(pixman::image&, int x, int y, std::span<const vte::cell>, unsigned cols);
 };
 
 ////////////////////////////////////////////////////////////////////////////////
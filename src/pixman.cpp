@@ -0,0 +1,206 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "pixman.hpp"
+
+#include <algorithm> // std::fill_n
+#include <cstring> // std::memcpy
+#include <cstdint> // std::uintptr_t
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define PIXMAN_X86
+#  include <immintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pixman
+{
+
+namespace
+{
+
+// blend solid pixel over dst with alpha a: (s * a + d * (255 - a)) / 255,
+// processing red and blue channels in parallel
+inline uint32_t blend(uint32_t d, uint32_t s, uint32_t a)
+{
+    auto na = 255 - a;
+
+    auto rb = (s & 0xff00ff) * a + (d & 0xff00ff) * na + 0x800080;
+    rb = ((rb + ((rb >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
+
+    auto g = (s & 0x00ff00) * a + (d & 0x00ff00) * na + 0x008000;
+    g = ((g + ((g >> 8) & 0x00ff00)) >> 8) & 0x00ff00;
+
+    return rb | g;
+}
+
+void fill_scalar(uint32_t* dst, std::size_t n, uint32_t pixel)
+{
+    std::fill_n(dst, n, pixel);
+}
+
+void blend_scalar(uint32_t* dst, const uint8_t* mask, std::size_t n, uint32_t pixel)
+{
+    for (std::size_t i = 0; i < n; ++i)
+        if (auto a = mask[i]; a == 0xff)
+            dst[i] = pixel;
+        else if (a) dst[i] = blend(dst[i], pixel, a);
+}
+
+void copy_scalar(uint32_t* dst, const uint32_t* src, std::size_t n)
+{
+    std::memcpy(dst, src, n * sizeof(*dst));
+}
+
+#ifdef PIXMAN_X86
+////////////////////////////////////////////////////////////////////////////////
+// blend 2 pixels (as 16-bit channels) with their alphas m
+__attribute__((target("sse2")))
+inline __m128i blend16_sse2(__m128i d, __m128i s, __m128i m)
+{
+    auto t = _mm_add_epi16(_mm_mullo_epi16(s, m), _mm_mullo_epi16(d, _mm_xor_si128(m, _mm_set1_epi16(0xff))));
+    t = _mm_add_epi16(t, _mm_set1_epi16(0x80));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// same for 4 pixels, 2 in each 128-bit lane
+__attribute__((target("avx2")))
+inline __m256i blend16_avx2(__m256i d, __m256i s, __m256i m)
+{
+    auto t = _mm256_add_epi16(_mm256_mullo_epi16(s, m), _mm256_mullo_epi16(d, _mm256_xor_si256(m, _mm256_set1_epi16(0xff))));
+    t = _mm256_add_epi16(t, _mm256_set1_epi16(0x80));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+void fill_sse2(uint32_t* dst, std::size_t n, uint32_t pixel)
+{
+    auto p = _mm_set1_epi32(pixel);
+
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), p);
+    fill_scalar(dst + i, n - i, pixel);
+}
+
+__attribute__((target("sse2")))
+void blend_sse2(uint32_t* dst, const uint8_t* mask, std::size_t n, uint32_t pixel)
+{
+    auto zero = _mm_setzero_si128();
+    auto p = _mm_set1_epi32(pixel);
+    auto s = _mm_unpacklo_epi8(p, zero);
+
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        uint32_t a;
+        std::memcpy(&a, mask + i, sizeof(a));
+        if (!a) continue;
+
+        auto to = reinterpret_cast<__m128i*>(dst + i);
+        if (a == 0xffffffff) { _mm_storeu_si128(to, p); continue; }
+
+        // a0 a1 a2 a3 => a0 a0 a1 a1 a2 a2 a3 a3 (16-bit) => a0 x4 a1 x4 | a2 x4 a3 x4
+        auto m = _mm_unpacklo_epi8(_mm_cvtsi32_si128(a), zero);
+        m = _mm_unpacklo_epi16(m, m);
+
+        auto d = _mm_loadu_si128(to);
+        auto lo = blend16_sse2(_mm_unpacklo_epi8(d, zero), s, _mm_unpacklo_epi32(m, m));
+        auto hi = blend16_sse2(_mm_unpackhi_epi8(d, zero), s, _mm_unpackhi_epi32(m, m));
+
+        _mm_storeu_si128(to, _mm_packus_epi16(lo, hi));
+    }
+    blend_scalar(dst + i, mask + i, n - i, pixel);
+}
+
+// non-temporal stores go straight to memory without reading dst into cache,
+// which is what write-combined scanout buffers want
+__attribute__((target("sse2")))
+void copy_sse2(uint32_t* dst, const uint32_t* src, std::size_t n)
+{
+    std::size_t i = 0;
+    for (; i < n && reinterpret_cast<std::uintptr_t>(dst + i) % 16; ++i) dst[i] = src[i];
+
+    for (; i + 4 <= n; i += 4)
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+    copy_scalar(dst + i, src + i, n - i);
+
+    _mm_sfence();
+}
+
+__attribute__((target("avx2")))
+void fill_avx2(uint32_t* dst, std::size_t n, uint32_t pixel)
+{
+    auto p = _mm256_set1_epi32(pixel);
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), p);
+    fill_sse2(dst + i, n - i, pixel);
+}
+
+__attribute__((target("avx2")))
+void blend_avx2(uint32_t* dst, const uint8_t* mask, std::size_t n, uint32_t pixel)
+{
+    auto zero = _mm256_setzero_si256();
+    auto p = _mm256_set1_epi32(pixel);
+    auto s = _mm256_unpacklo_epi8(p, zero);
+
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t a;
+        std::memcpy(&a, mask + i, sizeof(a));
+        if (!a) continue;
+
+        auto to = reinterpret_cast<__m256i*>(dst + i);
+        if (a == ~uint64_t{0}) { _mm256_storeu_si256(to, p); continue; }
+
+        // unpack works within 128-bit lanes, so spread alphas as 0-3 | 4-7
+        // and duplicate them into 16-bit pairs
+        auto m = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(mask + i)));
+        m = _mm256_or_si256(m, _mm256_slli_epi32(m, 16));
+
+        auto d = _mm256_loadu_si256(to);
+        auto lo = blend16_avx2(_mm256_unpacklo_epi8(d, zero), s, _mm256_unpacklo_epi32(m, m));
+        auto hi = blend16_avx2(_mm256_unpackhi_epi8(d, zero), s, _mm256_unpackhi_epi32(m, m));
+
+        _mm256_storeu_si256(to, _mm256_packus_epi16(lo, hi));
+    }
+    blend_sse2(dst + i, mask + i, n - i, pixel);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+struct kernels
+{
+    void (*fill)(uint32_t*, std::size_t, uint32_t);
+    void (*blend)(uint32_t*, const uint8_t*, std::size_t, uint32_t);
+    void (*copy)(uint32_t*, const uint32_t*, std::size_t);
+};
+
+kernels select()
+{
+#ifdef PIXMAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return { fill_avx2, blend_avx2, copy_sse2 };
+    if (__builtin_cpu_supports("sse2")) return { fill_sse2, blend_sse2, copy_sse2 };
+#endif
+    return { fill_scalar, blend_scalar, copy_scalar };
+}
+
+const kernels kernel = select();
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void fill_span(uint32_t* dst, std::size_t n, uint32_t pixel) { kernel.fill(dst, n, pixel); }
+
+void blend_span(uint32_t* dst, const uint8_t* mask, std::size_t n, uint32_t pixel) { kernel.blend(dst, mask, n, pixel); }
+
+void stream_span(uint32_t* dst, const uint32_t* src, std::size_t n) { kernel.copy(dst, src, n); }
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -7,14 +7,40 @@
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 
+#include "alloc.hpp"
+
+#include <algorithm> // std::max, std::min
+#include <cstddef>
+#include <cstdint>
+#include <cstring> // std::memmove
 #include <memory>
 #include <pixman.h>
+#include <type_traits>
+
+// in the global namespace along with pixman_color, so that ADL finds it
+constexpr bool operator==(const pixman_color& x, const pixman_color& y) noexcept
+{
+    return x.red == y.red && x.green == y.green && x.blue == y.blue && x.alpha == y.alpha;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 namespace pixman
 {
 
 using color = pixman_color;
+using box = pixman_box32;
+
+// convert color to x8r8g8b8 pixel value
+constexpr uint32_t to_pixel(const color& c) noexcept
+{
+    return (c.red >> 8) << 16 | (c.green >> 8) << 8 | (c.blue >> 8);
+}
+
+// x8r8g8b8 span kernels with runtime cpu dispatch (scalar, SSE2 or AVX2)
+void fill_span(uint32_t* dst, std::size_t n, uint32_t pixel);
+void blend_span(uint32_t* dst, const uint8_t* mask, std::size_t n, uint32_t pixel);
+// copy with non-temporal stores, for writing to uncached/write-combined memory
+void stream_span(uint32_t* dst, const uint32_t* src, std::size_t n);
 
 struct image_delete { void operator()(pixman_image* image) { pixman_image_unref(image); } };
 using image_ptr = std::unique_ptr<pixman_image, image_delete>;
@@ -32,12 +58,26 @@ public:
     template<typename D>
     auto data() { return reinterpret_cast<D>(pixman_image_get_data(&*pix_)); }
 
+    // read-only access; D must be a pointer to const
+    template<typename D>
+    auto data() const
+    {
+        static_assert(std::is_const_v<std::remove_pointer_t<D>>, "const image has read-only data");
+        return reinterpret_cast<D>(pixman_image_get_data(&*pix_));
+    }
+
 protected:
     ////////////////////
     image_ptr pix_;
     friend struct image;
 
     image_base(image_ptr pix) : pix_{std::move(pix)} { }
+
+    static image_ptr create(pixman_format_code_t format, unsigned w, unsigned h, std::size_t stride, void* p)
+    {
+        alloc::scope scope{alloc::image};
+        return image_ptr{pixman_image_create_bits(format, w, h, static_cast<uint32_t*>(p), stride)};
+    }
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -47,8 +87,10 @@ struct gray : image_base
     static constexpr unsigned bits_per_pixel = 8;
     static constexpr unsigned num_colors = 1 << depth;
 
-    gray(unsigned w, unsigned h) :
-        image_base{image_ptr{pixman_image_create_bits(PIXMAN_a8, w, h, nullptr, 0)}}
+    gray(unsigned w, unsigned h) : gray{w, h, 0, nullptr} { }
+
+    gray(unsigned w, unsigned h, std::size_t stride, void* p) :
+        image_base{create(PIXMAN_a8, w, h, stride, p)}
     { }
 };
 
@@ -62,14 +104,19 @@ struct image : image_base
     image(unsigned w, unsigned h) : image{w, h, 0, nullptr} { }
 
     image(unsigned w, unsigned h, std::size_t stride, void* p) :
-        image_base{image_ptr{pixman_image_create_bits(PIXMAN_x8r8g8b8, w, h, static_cast<uint32_t*>(p), stride)}}
+        image_base{create(PIXMAN_x8r8g8b8, w, h, stride, p)}
     { }
 
     ////////////////////
     void fill(int x, int y, unsigned w, unsigned h, const color& c)
     {
-        pixman_rectangle16 rect(x, y, w, h);
-        pixman_image_fill_rectangles(PIXMAN_OP_SRC, &*pix_, &c, 1, &rect);
+        int x0 = std::max(x, 0), x1 = std::min<int>(x + w, width());
+        int y0 = std::max(y, 0), y1 = std::min<int>(y + h, height());
+        if (x0 >= x1) return;
+
+        auto pitch = stride() / 4;
+        auto dst = data<uint32_t*>() + y0 * pitch + x0;
+        for (auto row = y0; row < y1; ++row, dst += pitch) fill_span(dst, x1 - x0, to_pixel(c));
     }
 
     void fill(int x, int y, const image& src)
@@ -82,10 +129,54 @@ struct image : image_base
         pixman_image_composite32(PIXMAN_OP_SRC, &*src.pix_, nullptr, &*pix_, src_x, src_y, 0, 0, x, y, w, h);
     }
 
+    // move contents of the box by dx, dy (source and destination may overlap)
+    void move(const box& b, int dx, int dy)
+    {
+        int x0 = std::max({b.x1, -dx, 0}), x1 = std::min<int>({b.x2, static_cast<int>(width()) - dx, static_cast<int>(width())});
+        int y0 = std::max({b.y1, -dy, 0}), y1 = std::min<int>({b.y2, static_cast<int>(height()) - dy, static_cast<int>(height())});
+        if (x0 >= x1 || y0 >= y1) return;
+
+        auto pitch = stride() / 4;
+        auto src = data<uint32_t*>() + y0 * pitch + x0;
+        auto dst = src + dy * pitch + dx;
+        auto size = (x1 - x0) * sizeof(uint32_t);
+
+        // moving down => go bottom up, so rows aren't overwritten before they're moved
+        if (dy > 0)
+            for (auto row = y1 - 1; row >= y0; --row) std::memmove(dst + (row - y0) * pitch, src + (row - y0) * pitch, size);
+        else for (auto row = y0; row < y1; ++row) std::memmove(dst + (row - y0) * pitch, src + (row - y0) * pitch, size);
+    }
+
+    // copy box from src at the same position, bypassing the cache;
+    // meant for pushing a shadow image out to scanout memory
+    void stream(const image& src, const box& b)
+    {
+        int x0 = std::max(b.x1, 0), x1 = std::min<int>({b.x2, static_cast<int>(width()), static_cast<int>(src.width())});
+        int y0 = std::max(b.y1, 0), y1 = std::min<int>({b.y2, static_cast<int>(height()), static_cast<int>(src.height())});
+        if (x0 >= x1) return;
+
+        auto pitch = stride() / 4, src_pitch = src.stride() / 4;
+        auto dst = data<uint32_t*>() + y0 * pitch + x0;
+        auto from = src.data<const uint32_t*>() + y0 * src_pitch + x0;
+        for (auto row = y0; row < y1; ++row, dst += pitch, from += src_pitch) stream_span(dst, from, x1 - x0);
+    }
+
     void alpha_blend(int x, int y, const gray& mask, const color& c)
     {
-        image_ptr solid{pixman_image_create_solid_fill(&c)};
-        pixman_image_composite32(PIXMAN_OP_OVER, &*solid, &*mask.pix_, &*pix_, 0, 0, 0, 0, x, y, mask.width(), mask.height());
+        alpha_blend(x, y, mask, c, box{0, 0, static_cast<int>(width()), static_cast<int>(height())});
+    }
+
+    // blend mask clipped to the clip box
+    void alpha_blend(int x, int y, const gray& mask, const color& c, const box& clip)
+    {
+        int x0 = std::max({x, clip.x1, 0}), x1 = std::min<int>({x + static_cast<int>(mask.width()), clip.x2, static_cast<int>(width())});
+        int y0 = std::max({y, clip.y1, 0}), y1 = std::min<int>({y + static_cast<int>(mask.height()), clip.y2, static_cast<int>(height())});
+        if (x0 >= x1) return;
+
+        auto pitch = stride() / 4;
+        auto dst = data<uint32_t*>() + y0 * pitch + x0;
+        auto src = mask.data<const uint8_t*>() + (y0 - y) * mask.stride() + (x0 - x);
+        for (auto row = y0; row < y1; ++row, dst += pitch, src += mask.stride()) blend_span(dst, src, x1 - x0, to_pixel(c));
     }
 };
 
@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "pool.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pool
+{
+
+workers::workers(unsigned n)
+{
+    for (unsigned i = 1; i < n; ++i) threads_.emplace_back([this, i]{ work(i); });
+}
+
+workers::~workers()
+{
+    {
+        std::lock_guard lock{mutex_};
+        stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& thread : threads_) thread.join();
+}
+
+void workers::run(call fn, void* job)
+{
+    {
+        std::lock_guard lock{mutex_};
+        call_ = fn;
+        job_ = job;
+        busy_ = threads_.size();
+        error_ = nullptr;
+        ++gen_;
+    }
+    start_.notify_all();
+
+    std::exception_ptr error;
+    try { fn(job, 0); }
+    catch (...) { error = std::current_exception(); }
+
+    std::unique_lock lock{mutex_};
+    done_.wait(lock, [&]{ return !busy_; });
+
+    if (!error) error = error_;
+    if (error) std::rethrow_exception(error);
+}
+
+void workers::work(unsigned i)
+{
+    unsigned gen = 0;
+    for (;;)
+    {
+        std::unique_lock lock{mutex_};
+        start_.wait(lock, [&]{ return stop_ || gen_ != gen; });
+        if (stop_) break;
+
+        gen = gen_;
+        auto fn = call_;
+        auto job = job_;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try { fn(job, i); }
+        catch (...) { error = std::current_exception(); }
+
+        lock.lock();
+        if (error && !error_) error_ = error;
+        if (!--busy_) done_.notify_one();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+}
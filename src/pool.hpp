@@ -0,0 +1,64 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <memory> // std::addressof
+#include <mutex>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace pool
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// fixed set of threads that run the same job in parallel
+//
+class workers
+{
+public:
+    ////////////////////
+    // n = total number of threads, including the caller of run()
+    explicit workers(unsigned n);
+    ~workers();
+
+    workers(const workers&) = delete;
+    workers& operator=(const workers&) = delete;
+
+    auto size() const noexcept { return static_cast<unsigned>(threads_.size() + 1); }
+
+    // call job(i) for each i in [0, size()), job(0) on the calling thread;
+    // returns once all of them are done and rethrows the first exception
+    template<typename Job>
+    void run(Job& job)
+    {
+        run(+[](void* job, unsigned i){ (*static_cast<Job*>(job))(i); }, std::addressof(job));
+    }
+
+private:
+    ////////////////////
+    using call = void(*)(void*, unsigned);
+    void run(call, void* job);
+
+    std::mutex mutex_;
+    std::condition_variable start_, done_;
+
+    call call_ = nullptr;
+    void* job_ = nullptr;
+    unsigned gen_ = 0, busy_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+
+    std::vector<std::thread> threads_;
+    void work(unsigned i);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,275 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#include "error.hpp"
+#include "logging.hpp"
+#include "psf.hpp"
+
+#include <algorithm> // std::min
+#include <cstdint>
+#include <stdexcept>
+
+#include <fcntl.h> // open
+#include <sys/mman.h>
+#include <sys/stat.h> // fstat
+#include <unistd.h> // close
+#include <zlib.h>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace psf
+{
+
+namespace
+{
+
+constexpr std::uint8_t psf1_magic[] = { 0x36, 0x04 };
+constexpr std::uint8_t psf2_magic[] = { 0x72, 0xb5, 0x4a, 0x86 };
+
+enum psf1_mode : std::uint8_t { psf1_512 = 0x01, psf1_has_tab = 0x02, psf1_has_seq = 0x04 };
+enum psf2_flags : std::uint32_t { psf2_has_tab = 0x01 };
+
+constexpr std::size_t psf1_header_size = 4;
+constexpr std::size_t psf2_header_size = 32;
+
+constexpr std::uint16_t psf1_separator = 0xffff, psf1_start_seq = 0xfffe;
+constexpr std::uint8_t psf2_separator = 0xff, psf2_start_seq = 0xfe;
+
+inline std::uint16_t read16(const std::uint8_t* p) { return p[0] | p[1] << 8; }
+inline std::uint32_t read32(const std::uint8_t* p) { return p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24; }
+
+inline bool is_gzip(std::string_view name) { return name.ends_with(".gz"); }
+
+auto decompress(const std::string& path)
+{
+    auto gz = gzopen(path.data(), "rb");
+    if (!gz) throw posix_error{"gzopen"};
+
+    std::vector<std::uint8_t> buffer;
+    for (;;)
+    {
+        constexpr std::size_t chunk = 16384;
+
+        auto size = buffer.size();
+        buffer.resize(size + chunk);
+
+        auto n = gzread(gz, buffer.data() + size, chunk);
+        if (n < 0)
+        {
+            gzclose(gz);
+            throw std::runtime_error{"Failed to decompress font " + path};
+        }
+
+        buffer.resize(size + n);
+        if (n == 0) break;
+    }
+
+    gzclose(gz);
+    return buffer;
+}
+
+// decode one utf-8 encoded code point
+char32_t decode(const std::uint8_t*& p, const std::uint8_t* end)
+{
+    char32_t cp;
+    int n;
+
+         if ( *p < 0x80        ) n = 0, cp = *p;        // 0xxxxxxx
+    else if ((*p & 0xe0) == 0xc0) n = 1, cp = *p & 0x1f; // 110xxxxx 10xxxxxx
+    else if ((*p & 0xf0) == 0xe0) n = 2, cp = *p & 0x0f; // 1110xxxx 10xxxxxx 10xxxxxx
+    else if ((*p & 0xf8) == 0xf0) n = 3, cp = *p & 0x07; // 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
+    else n = 0, cp = 0xfffd;
+    ++p;
+
+    for (; n && p < end; --n, ++p) cp = (cp << 6) | (*p & 0x3f);
+    return cp;
+}
+
+// draw glyph bits, along with bold, underline and strike-through
+template<typename T>
+void draw(T* data, std::size_t pitch, unsigned w, unsigned h, unsigned glyph_w, const std::uint8_t* bits, unsigned bits_pitch, const vte::attrs& attrs, T value)
+{
+    auto bit = [&](unsigned col) { return col < glyph_w && (bits[col >> 3] & (0x80 >> (col & 7))); };
+
+    for (unsigned row = 0; row < h; ++row, bits += bits_pitch, data += pitch)
+    {
+        bool line = (attrs.underline && (row == h - 1 || (attrs.underline == 2 && row == h - 3)))
+                 || (attrs.strike && row == h / 2);
+
+        for (unsigned col = 0; col < w; ++col)
+            if (line || bit(col) || (attrs.bold && col && bit(col - 1))) data[col] = value;
+    }
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool is_font(std::string_view name)
+{
+    if (is_gzip(name)) name.remove_suffix(3);
+    return name.ends_with(".psf") || name.ends_with(".psfu");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+engine::engine(const std::string& path) : font::engine{0}
+{
+    if (is_gzip(path))
+    {
+        buffer_ = decompress(path);
+        data_ = buffer_;
+    }
+    else
+    {
+        map_.emplace(path);
+        data_ = std::span{static_cast<const std::uint8_t*>(map_->data), map_->size};
+    }
+
+    if (data_.size() >= psf2_header_size && std::equal(std::begin(psf2_magic), std::end(psf2_magic), data_.begin()))
+        parse_psf2();
+
+    else if (data_.size() >= psf1_header_size && std::equal(std::begin(psf1_magic), std::end(psf1_magic), data_.begin()))
+        parse_psf1();
+
+    else throw std::runtime_error{"Invalid PSF font " + path};
+
+    for (char32_t cp : { U'\ufffd', U'?' })
+        if (auto it = unimap_.find(cp); it != unimap_.end())
+        {
+            fallback_ = it->second;
+            break;
+        }
+
+    info() << "Using font: " << path << ", glyphs=" << count_ << ", box=" << box_.width << "x" << box_.height;
+}
+
+void engine::parse_psf1()
+{
+    auto mode = data_[2];
+
+    count_ = (mode & psf1_512) ? 512 : 256;
+    glyph_size_ = data_[3];
+    pitch_ = 1;
+
+    if (!glyph_size_) throw std::runtime_error{"Invalid PSF font header"};
+    box_ = font::box{ .width = 8, .height = glyph_size_, .baseline = static_cast<int>(glyph_size_) };
+
+    if (count_ * glyph_size_ > data_.size() - psf1_header_size) throw std::runtime_error{"Truncated PSF font"};
+
+    glyphs_ = data_.data() + psf1_header_size;
+    auto p = glyphs_ + count_ * glyph_size_, end = data_.data() + data_.size();
+
+    if (mode & (psf1_has_tab | psf1_has_seq))
+    {
+        for (unsigned n = 0; n < count_ && p + 2 <= end; ++n)
+        {
+            bool seq = false;
+            for (; p + 2 <= end; p += 2)
+            {
+                auto cp = read16(p);
+                if (cp == psf1_separator) { p += 2; break; }
+                if (cp == psf1_start_seq) seq = true;
+                else if (!seq) unimap_.emplace(cp, n);
+            }
+        }
+    }
+    else for (unsigned n = 0; n < count_; ++n) unimap_.emplace(n, n);
+}
+
+void engine::parse_psf2()
+{
+    auto header_size = read32(&data_[8]);
+    auto flags = read32(&data_[12]);
+
+    count_ = read32(&data_[16]);
+    glyph_size_ = read32(&data_[20]);
+    box_.height = read32(&data_[24]);
+    box_.width = read32(&data_[28]);
+    box_.baseline = box_.height;
+    pitch_ = (box_.width + 7) / 8;
+
+    if (header_size < psf2_header_size || header_size > data_.size() || !count_ || !box_.width || !box_.height
+        || glyph_size_ < std::uint64_t{pitch_} * box_.height) throw std::runtime_error{"Invalid PSF font header"};
+
+    // check sizes before forming any pointers past the end
+    if (std::uint64_t{count_} * glyph_size_ > data_.size() - header_size) throw std::runtime_error{"Truncated PSF font"};
+
+    glyphs_ = data_.data() + header_size;
+    auto p = glyphs_ + std::size_t{count_} * glyph_size_, end = data_.data() + data_.size();
+
+    if (flags & psf2_has_tab)
+    {
+        for (unsigned n = 0; n < count_ && p < end; ++n)
+        {
+            bool seq = false;
+            while (p < end)
+            {
+                if (*p == psf2_separator) { ++p; break; }
+                if (*p == psf2_start_seq) { seq = true; ++p; continue; }
+
+                auto cp = decode(p, end);
+                if (!seq) unimap_.emplace(cp, n);
+            }
+        }
+    }
+    else for (unsigned n = 0; n < count_; ++n) unimap_.emplace(n, n);
+}
+
+const std::uint8_t* engine::glyph(const vte::cell& cell) const
+{
+    auto n = fallback_;
+    if (auto cp = font::to_code_point(cell))
+        if (auto it = unimap_.find(*cp); it != unimap_.end()) n = it->second;
+
+    return glyphs_ + n * glyph_size_;
+}
+
+void engine::render_text(pixman::image& image, int x, int y, std::span<const vte::cell> cells)
+{
+    int right = std::min<int>(clip_.x2, image.width());
+    auto h = std::min<int>(box_.height, image.height() - y);
+
+    for (auto to = cells.begin(); to < cells.end() && x < right; to += to->width)
+    {
+        auto w = std::min<int>(box_.width * to->width, right - x);
+        if (!font::is_blank(*to))
+        {
+            auto data = image.data<std::uint32_t*>() + y * image.stride() / 4 + x;
+            draw(data, image.stride() / 4, w, h, box_.width, glyph(*to), pitch_, to->attrs, pixman::to_pixel(to->fg));
+        }
+        x += box_.width * to->width;
+    }
+}
+
+pixman::gray engine::rasterize(const vte::cell& cell)
+{
+    pixman::gray mask{box_.width * cell.width, box_.height};
+    draw<std::uint8_t>(mask.data<std::uint8_t*>(), mask.stride(), mask.width(), mask.height(), box_.width, glyph(cell), pitch_, cell.attrs, 0xff);
+    return mask;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+engine::scoped_mapped_file::scoped_mapped_file(const std::string& path)
+{
+    auto fd = ::open(path.data(), O_RDONLY);
+    if (fd < 0) throw posix_error{"open"};
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        throw posix_error{"fstat"};
+    }
+    size = st.st_size;
+
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) throw posix_error{"mmap"};
+}
+
+engine::scoped_mapped_file::~scoped_mapped_file() { munmap(data, size); }
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -0,0 +1,69 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "font.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+namespace psf
+{
+
+// check if name refers to a PSF font file (eg, /usr/share/consolefonts/*.psf.gz)
+bool is_font(std::string_view name);
+
+////////////////////////////////////////////////////////////////////////////////
+// renders PC screen fonts (PSF1 and PSF2) by blitting their 1-bit glyphs
+// straight into the image; does not need fontconfig, pango or freetype
+//
+class engine : public font::engine
+{
+public:
+    ////////////////////
+    explicit engine(const std::string& path);
+
+private:
+    ////////////////////
+    struct scoped_mapped_file
+    {
+        void* data;
+        std::size_t size;
+
+        explicit scoped_mapped_file(const std::string& path);
+        ~scoped_mapped_file();
+    };
+
+    std::optional<scoped_mapped_file> map_;
+    std::vector<std::uint8_t> buffer_; // decompressed font
+    std::span<const std::uint8_t> data_;
+
+    const std::uint8_t* glyphs_;
+    unsigned count_, glyph_size_, pitch_;
+
+    std::unordered_map<char32_t, unsigned> unimap_;
+    unsigned fallback_ = 0;
+
+    void parse_psf1();
+    void parse_psf2();
+
+    const std::uint8_t* glyph(const vte::cell&) const;
+
+    void render_text(pixman::image&, int x, int y, std::span<const vte::cell>) override;
+    pixman::gray rasterize(const vte::cell&) override;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+}
@@ -5,26 +5,88 @@
 // Distributed under the GNU GPL license. See the LICENSE.md file for details.
 
 ////////////////////////////////////////////////////////////////////////////////
+#include "alloc.hpp"
+#include "ft.hpp"
 #include "logging.hpp"
+#include "psf.hpp"
 #include "term.hpp"
 
+#include <algorithm> // std::clamp, std::copy_n, std::equal, std::max, std::min
+#include <cstring> // std::memmove
 #include <exception>
+#include <thread>
+#include <utility> // std::exchange, std::swap
 
 ////////////////////////////////////////////////////////////////////////////////
-term::term(const asio::any_io_executor& ex, term_options options)
+term::term(const asio::any_io_executor& ex, term_options options) : timer_{ex}
 {
     tty_ = std::make_unique<tty::device>(ex, options.tty_num);
     if (options.tty_activate) tty_->activate();
 
-    drm_ = std::make_unique<drm::device>(ex, options.drm_num);
+    drm_ = std::make_unique<drm::device>(ex, options.drm_num, options.latency);
+    latency_ = options.latency;
     mode_ = drm_->mode();
-    fb_ = std::make_unique<drm::framebuf>(*drm_, mode_.width, mode_.height);
 
-    pango_ = std::make_unique<pango::engine>(options.font, options.dpi.value_or(mode_.dpi));
-    box_ = pango_->box();
+    bufs_.resize(std::clamp(options.buffers, 1u, 3u));
+    if (bufs_.size() == 1 && options.pan)
+    {
+        try // may exceed max framebuf height
+        {
+            bufs_[0].fb = std::make_unique<drm::framebuf>(*drm_, mode_.width, mode_.height, 2);
+            pan_ = true;
+        }
+        catch (const std::exception& e) { err() << "Panning disabled: " << e.what(); }
+    }
+    else if (options.pan) err() << "Panning disabled: needs a single framebuf";
+    for (auto& buf : bufs_)
+        if (!buf.fb) buf.fb = std::make_unique<drm::framebuf>(*drm_, mode_.width, mode_.height);
+    info() << "Using " << bufs_.size() << " framebuf(s)" << (bufs_.size() > 1 ? " with page flipping" : "");
+
+    // panning moves the scanout, not pixels => a shadow would have to be moved instead
+    if (options.shadow && pan_) info() << "Shadow framebuf disabled for panning";
+    else if (options.shadow) shadow_.emplace(mode_.width, mode_.height);
+    info() << "Shadow framebuf: " << (shadow_ ? "on" : "off") << ", panning: " << (pan_ ? "on" : "off");
+
+    alloc_budget_ = options.alloc_budget;
+    if (options.max_fps) frame_time_ = std::chrono::duration_cast<clock::duration>(std::chrono::seconds{1}) / options.max_fps;
+
+    auto dpi = options.dpi.value_or(mode_.dpi);
+    auto glyph_cache = options.glyph_cache * 1024;
+
+    // each render thread gets its own engine (and pango/freetype context)
+    auto create_font = [&](arena::frame* frame) -> std::unique_ptr<font::engine>
+    {
+        std::unique_ptr<font::engine> font;
+        if (psf::is_font(options.font))
+            font = std::make_unique<psf::engine>(options.font);
+
+        else if (options.freetype)
+            font = std::make_unique<ft::engine>(options.font, dpi, glyph_cache, options.shaping);
+        else font = std::make_unique<pango::engine>(options.font, dpi, glyph_cache, options.shaping);
+
+        font->scratch(frame);
+        if (options.tile_cache) font->cache_tiles(options.tile_cache * 1024);
+        return font;
+    };
+    font_ = create_font(&frame_);
+    box_ = font_->box();
+    contexts_.push_back(context{&*font_, &frame_});
+
+    auto threads = options.threads ? options.threads : std::max(std::thread::hardware_concurrency(), 1u);
+    for (unsigned n = 1; n < threads; ++n)
+    {
+        frames_.push_back(std::make_unique<arena::frame>(frame_.capacity()));
+        fonts_.push_back(create_font(&*frames_.back()));
+        contexts_.push_back(context{&*fonts_.back(), &*frames_.back()});
+    }
+    if (threads > 1) pool_ = std::make_unique<pool::workers>(threads);
+    info() << "Render threads: " << threads;
 
     size_.rows = mode_.height / box_.height;
     size_.cols = mode_.width / box_.width;
+    dirty_.resize(size_.rows);
+    grid_.resize(size_.rows * size_.cols);
+    if (options.row_cache) rows_.emplace(options.row_cache * 1024);
 
     vte_ = std::make_unique<vte::machine>(size_.rows, size_.cols);
     show_cursor(keyboard);
@@ -35,16 +97,19 @@ term::term(const asio::any_io_executor& ex, term_options options)
         mouse_ = std::make_unique<mouse::device>(ex, size_.rows, size_.cols, options.mouse_speed);
     }
     catch (const std::exception& e) { err() << e.what(); }
+    if (mouse_) create_pointer();
 
     tty_->on_acquired([&]{ activate(); });
     tty_->on_released([&]{ deactivate(); });
     tty_->on_data_received([&](auto data){ vte_->send(data); });
 
+    drm_->on_flipped([&](){ flipped(); });
     drm_->on_vblank([&](){ update(); });
     if (options.tty_num == tty::active(ex)) activate();
 
     vte_->on_send_data([&](auto data){ pty_->send(data); });
-    vte_->on_row_changed([&](auto row, auto col, auto cols){ update(row, col, cols); });
+    vte_->on_row_changed([&](auto row, auto col, auto cols){ invalidate(row, col, cols); });
+    vte_->on_rect_moved([&](auto& dst, auto& src){ move(dst, src); });
     vte_->on_cursor_moved([&](auto row, auto col)
     {
         hide_cursor(mouse);
@@ -53,15 +118,21 @@ term::term(const asio::any_io_executor& ex, term_options options)
     vte_->on_cursor_changed([&](auto&& cursor){ change(keyboard, cursor); });
     vte_->on_size_changed([&](auto rows, auto cols){ pty_->resize(rows, cols); });
 
-    pty_->on_data_received([&](auto data){ vte_->recv(data); });
+    pty_->on_data_received([&](auto data)
+    {
+        vte_->recv(data);
+        schedule();
+    });
 
     if (mouse_)
     {
         mouse_->on_moved([&](auto row, auto col)
         {
-            show_cursor(mouse);
+            // move first, so that the pointer shows up (or moves) in one go
             move_cursor(mouse, row, col);
+            show_cursor(mouse);
             vte_->move_mouse(row, col);
+            schedule();
         });
         mouse_->on_button_changed([&](auto button, auto state){ vte_->change(button, state); });
 
@@ -69,14 +140,46 @@ term::term(const asio::any_io_executor& ex, term_options options)
     }
 }
 
+term::~term()
+{
+    auto stats = glyph_stats();
+    info() << "Glyph cache: hits=" << stats.hits << ", misses=" << stats.misses << ", entries=" << stats.entries << ", size=" << stats.size;
+
+    if (auto stats = tile_stats(); stats.hits + stats.misses)
+    {
+        auto total = stats.hits + stats.misses;
+        info() << "Tile cache: hits=" << stats.hits << ", misses=" << stats.misses << " (" << stats.hits * 100 / total << "% hit rate), entries=" << stats.entries << ", size=" << stats.size;
+    }
+
+    if (rows_)
+    {
+        auto& stats = rows_->stats();
+        auto total = stats.hits + stats.misses;
+        info() << "Row cache: hits=" << stats.hits << ", misses=" << stats.misses << " (" << (total ? stats.hits * 100 / total : 0) << "% hit rate), entries=" << stats.entries << ", size=" << stats.size;
+    }
+
+    auto total = cells_rendered_ + cells_skipped_;
+    info() << "Damaged cells: rendered=" << cells_rendered_ << ", skipped=" << cells_skipped_ << " (" << (total ? cells_skipped_ * 100 / total : 0) << "%)";
+}
+
 void term::activate()
 {
     info() << "Activating terminal";
     active_ = true;
 
     drm_->acquire_master();
-    drm_->set_output(*fb_);
+
+    // show the most recent frame; anything queued while we were away is moot
+    shown_ = last_;
+    pending_.reset();
+    ready_.reset();
+    drm_->set_output(*bufs_[shown_].fb);
+
     if (mouse_) mouse_->activate();
+
+    pointer_shown_ = false;
+    update_pointer();
+    schedule();
 }
 
 void term::deactivate()
@@ -91,123 +194,597 @@ void term::deactivate()
 namespace
 {
 
-inline bool is_blank(const vte::cell& cell)
+// FNV-1a over everything that affects how the cells look
+std::uint64_t hash(std::span<const vte::cell> cells)
 {
-    return !cell.len || cell.chars[0] == ' ' || cell.attrs.conceal;
+    std::uint64_t h = 0xcbf29ce484222325;
+    auto mix = [&](std::uint64_t v){ h = (h ^ v) * 0x100000001b3; };
+
+    for (auto& cell : cells)
+    {
+        mix(cell.len | cell.width << 8 | font::to_style(cell.attrs) << 16 | cell.attrs.conceal << 24);
+        mix(std::uint64_t{pixman::to_pixel(cell.fg)} << 32 | pixman::to_pixel(cell.bg));
+        for (std::size_t n = 0; n < cell.len; ++n) mix(static_cast<unsigned char>(cell.chars[n]));
+    }
+    return h;
 }
 
 }
 
-void term::update(int row, int col, unsigned count)
+void term::invalidate(int row, int col, unsigned count)
 {
-    if (row >= 0 && row < size_.rows)
+    if (row >= 0 && row < static_cast<int>(size_.rows))
     {
-        auto col_end = col + count;
-        if (col < 0) col = 0;
-        if (col_end > size_.cols) col_end = size_.cols;
+        auto& span = dirty_[row];
+        int end = col + count;
 
-        // grab extra cell before and after to deal with overhang
-        bool before = (col > 0); if (before) --col;
-        bool after = (col_end < size_.cols); if (after) ++col_end;
+        if (span.col < span.end)
+        {
+            span.col = std::min(span.col, col);
+            span.end = std::max(span.end, end);
+        }
+        else span = {col, end};
 
-        auto cells = vte_->cells(row, col, col_end - col);
+        is_dirty_ = true;
+    }
+}
+
+void term::move(const vte::rect& dst, const vte::rect& src)
+{
+    // without a shadow, there is no single image that can be moved
+    // (other than in single-buffer mode) => re-render instead;
+    // grid_ still describes the pixels, so only rows that differ get drawn
+    auto image = shadow_ ? &*shadow_ : bufs_.size() == 1 ? &bufs_[0].fb->image() : nullptr;
+    if (!image)
+    {
+        for (auto row = dst.start_row; row < dst.end_row; ++row) invalidate(row, dst.start_col, dst.end_col - dst.start_col);
+        return;
+    }
 
-        if (before && is_blank(*cells.begin()))
+    // the cursor goes along with the pixels => make sure it gets redrawn
+    for (auto k : {keyboard, mouse}) invalidate(k);
+
+    // carry pending updates and seen cells along with the rows they belong to
+    auto dy = dst.start_row - src.start_row, dx = dst.start_col - src.start_col;
+    bool full = (src.start_col == 0 && src.end_col == static_cast<int>(size_.cols));
+
+    auto carry = [&](int row)
+    {
+        std::memmove(seen(row) + dst.start_col, seen(row - dy) + src.start_col, (src.end_col - src.start_col) * sizeof(seen_cell));
+
+        auto from = dirty_[row - dy];
+        if (from.col < from.end) from = {from.col + dx, from.end + dx};
+
+        if (full) dirty_[row] = from;
+        else if (from.col < from.end) invalidate(row, from.col, from.end - from.col);
+    };
+    if (dy > 0)
+        for (auto row = dst.end_row - 1; row >= dst.start_row; --row) carry(row);
+    else for (auto row = dst.start_row; row < dst.end_row; ++row) carry(row);
+
+    int x = src.start_col * box_.width, y = src.start_row * box_.height;
+    int w = (src.end_col - src.start_col) * box_.width, h = (src.end_row - src.start_row) * box_.height;
+    dx *= box_.width, dy *= box_.height;
+
+    bool screen = full && std::min(src.start_row, dst.start_row) == 0 && std::max(src.end_row, dst.end_row) == static_cast<int>(size_.rows);
+    if (pan_ && screen)
+    {
+        // whole screen scrolled => slide the scanout instead of moving pixels
+        auto& fb = *bufs_[0].fb;
+        if (shadow_) shadow_->move(pixman::box{x, y, x + w, y + h}, 0, dy);
+
+        // pending changes scroll along
+        damage_.move(0, dy, pixman::box{0, 0, static_cast<int>(mode_.width), static_cast<int>(mode_.height)});
+        fb.scroll(dy, shadow_ ? &*shadow_ : nullptr);
+
+        // whatever scrolled into the margin below the last row
+        if (int bottom = size_.rows * box_.height; bottom < static_cast<int>(mode_.height))
         {
-            cells.erase(cells.begin());
-            ++col;
+            fb.image().fill(0, bottom, mode_.width, mode_.height - bottom, pixman::color{});
+            damage_.add(pixman::box{0, bottom, static_cast<int>(mode_.width), static_cast<int>(mode_.height)});
         }
-        if (after && !is_blank(*cells.rbegin()))
+
+        // rows exposed by the slide hold pixels from the ring's previous lap,
+        // which grid_ knows nothing about => render them in full
+        for (auto row = src.start_row; row < src.end_row; ++row)
+            if (row < dst.start_row || row >= dst.end_row) forget(row, 0, size_.cols);
+
+        // scanout moves once the exposed rows are drawn, see update()
+        pan_pending_ = true;
+    }
+    else
+    {
+        image->move(pixman::box{x, y, x + w, y + h}, dx, dy);
+
+        x += dx, y += dy;
+        damage_.add(pixman::box{x, y, x + w, y + h});
+    }
+
+    for (auto k : {keyboard, mouse}) invalidate(k);
+}
+
+void term::schedule()
+{
+    // nothing is drawn while inactive; activate() reschedules
+    if (!active_ || throttled_) return;
+
+    auto now = clock::now();
+    auto start = last_frame_ + frame_time_;
+
+    // start as late as possible while still making the next vblank, so that
+    // the frame picks up as much input as it can
+    std::optional<clock::time_point> vblank;
+    if (!latency_) vblank = drm_->next_vblank(now);
+    if (vblank) start = std::max(start, *vblank - render_cost_ - render_cost_ / 2 - margin);
+
+    if (now < start)
+    {
+        throttled_ = true;
+        timer_.expires_at(start);
+        timer_.async_wait([&](std::error_code ec)
+        {
+            throttled_ = false;
+            if (!ec) update();
+        });
+    }
+    // without vblank timing a single buffer is drawn on vblank, unless latency matters more
+    else if (vblank || bufs_.size() > 1 || latency_)
+        update();
+    else drm_->request_vblank();
+}
+
+std::optional<std::size_t> term::acquire()
+{
+    if (bufs_.size() == 1) return 0;
+
+    for (std::size_t n = 0; n < bufs_.size(); ++n)
+        if (n != shown_ && n != pending_ && n != ready_) return n;
+
+    return {};
+}
+
+void term::update()
+{
+    // flushing vterm damage moves rows around (scrolling) => that's part of the cost
+    auto t0 = clock::now();
+    vte_->commit();
+    if (!active_) return;
+
+    // cursors only record their state as they change; once per frame
+    // erase them from where they were drawn and draw them at the new spot
+    for (auto k : {keyboard, mouse})
+        if (cursor_[k] != drawn_[k])
         {
-            cells.pop_back();
-            --col_end;
+            invalidate(k);
+            drawn_[k] = cursor_[k];
+            invalidate(k);
         }
 
-        auto image = pango_->render(cells);
+    if (!is_dirty_ && damage_.empty())
+    {
+        if (bufs_.size() == 1 && bufs_[0].fb->pending()) flush(*bufs_[0].fb);
+        return;
+    }
+
+    // all buffers are busy => try again once the pending flip completes
+    auto n = acquire();
+    if (!n) return;
+
+    auto& buf = bufs_[*n];
+
+    if (shadow_)
+    {
+        render(*shadow_, damage_);
 
-        int x = col * box_.width, y = row * box_.height;
-        fb_->image().fill(x, y, image);
+        // shadow has the latest of everything; push out what this buffer is missing
+        buf.stale.add(damage_);
+        for (auto& box : buf.stale.clips()) buf.fb->image().stream(*shadow_, box);
+    }
+    else
+    {
+        // bring the buffer up to date with the most recent one
+        auto& last = bufs_[last_];
+        for (auto& box : buf.stale.clips())
+            buf.fb->image().fill(box.x1, box.y1, last.fb->image(), box.x1, box.y1, box.x2 - box.x1, box.y2 - box.y1);
+
+        render(buf.fb->image(), damage_);
+    }
+    buf.stale.clear();
+    last_ = *n;
+
+    if (bufs_.size() == 1)
+    {
+        if (std::exchange(pan_pending_, false)) drm_->pan(*buf.fb);
 
+        buf.fb->damage(damage_);
+        flush(*buf.fb);
+    }
+    else
+    {
+        for (auto& other : bufs_)
+            if (&other != &buf) other.stale.add(damage_);
+
+        // a flip left over from before activate() still counts as pending
+        if (pending_ || drm_->flip_pending()) ready_ = *n;
+        else
+        {
+            drm_->flip(*buf.fb);
+            pending_ = *n;
+        }
+    }
+
+    damage_.clear();
+    last_frame_ = clock::now();
+
+    // rise with the slowest frame, decay slowly
+    auto cost = last_frame_ - t0;
+    render_cost_ = std::max(cost, (render_cost_ * 7 + cost) / 8);
+
+    frame_.reset();
+    for (auto& frame : frames_) frame->reset();
+    if constexpr (alloc::enabled) check_allocs();
+}
+
+void term::flipped()
+{
+    if (pending_) shown_ = *std::exchange(pending_, std::nullopt);
+
+    if (active_ && ready_)
+    {
+        drm_->flip(*bufs_[*ready_].fb);
+        pending_ = std::exchange(ready_, std::nullopt);
+    }
+
+    schedule();
+}
+
+void term::flush(drm::framebuf& fb)
+{
+    fb.commit();
+    // device was busy => try again on the next vblank
+    if (fb.pending()) drm_->request_vblank();
+}
+
+void term::render(pixman::image& image, drm::damage& damage)
+{
+    int rows = size_.rows, dirty = 0;
+    for (auto& span : dirty_) dirty += span.col < span.end;
+
+    // not worth waking up the other threads for a few rows
+    unsigned n = pool_ && dirty >= 2 * static_cast<int>(pool_->size()) ? pool_->size() : 1;
+
+    auto job = [&](unsigned i)
+    {
+        auto& ctx = contexts_[i];
+        for (int row = i; row < rows; row += n)
+            if (auto span = std::exchange(dirty_[row], {}); span.col < span.end)
+                render(image, row, span, ctx);
+    };
+    if (n > 1) pool_->run(job);
+    else job(0);
+
+    bool cursor[kind::size] {};
+    for (auto& ctx : std::span{contexts_}.first(n))
+    {
+        damage.add(ctx.damage);
+        ctx.damage.clear();
+
+        cells_rendered_ += std::exchange(ctx.rendered, 0);
+        cells_skipped_ += std::exchange(ctx.skipped, 0);
+
+        for (auto k : {keyboard, mouse}) cursor[k] |= std::exchange(ctx.cursor[k], false);
+    }
+
+    // drawn here, since they use the main font engine
+    for (auto k : {keyboard, mouse})
+        if (cursor[k]) draw_cursor(k, image);
+
+    is_dirty_ = false;
+}
+
+void term::render(pixman::image& image, int row, span span, context& ctx)
+{
+    int cols = size_.cols;
+    auto col = std::max(span.col, 0), end = std::min(span.end, cols);
+    if (col >= end) return;
+
+    // up to 2 extra cells on each side for wide cells and overhang,
+    // or the whole row if it might come from (or go to) the row cache
+    auto first = rows_ ? 0 : std::max(col - 2, 0), last = rows_ ? cols : std::min(end + 2, cols);
+    auto cells = vte_->cells(row, first, last - first, ctx.frame);
+    auto cell = [&](int c) -> auto& { return cells[c - first]; };
+
+    auto seen = this->seen(row);
+    int changed = 0;
+    for (auto c = col; c < end; ++c) changed += !seen[c].matches(cell(c));
+
+    ctx.rendered += changed;
+    ctx.skipped += (end - col) - changed;
+    if (!changed) return;
+
+    int y = row * box_.height;
+    auto w = box_.width * cols, h = box_.height;
+
+    auto draw_cursors = [&](int from, int to)
+    {
         for (auto k : {keyboard, mouse})
-            if (cursor_[k].row == row && cursor_[k].col >= col && cursor_[k].col < col_end)
-                draw_cursor(k);
+            if (drawn_[k].row == row && drawn_[k].col >= from && drawn_[k].col < to)
+                ctx.cursor[k] = true;
+    };
+    auto remember = [&](int from, int to){ for (auto n = from; n < to; ++n) seen[n].assign(cell(n)); };
+
+    if (rows_)
+    {
+        auto key = hash(cells);
+        auto same = [&](const cached_row& row)
+        {
+            return std::equal(cells.begin(), cells.end(), row.cells.begin(), [](auto& cell, auto& seen){ return seen.matches(cell); });
+        };
+
+        std::shared_ptr<const cached_row> entry;
+        {
+            std::lock_guard lock{rows_mutex_};
+            if (auto found = rows_->find(key)) entry = *found;
+        }
+
+        if (entry && same(*entry))
+        {
+            image.fill(0, y, entry->bitmap);
+            ctx.damage.add(pixman::box{0, y, static_cast<int>(w), y + static_cast<int>(h)});
+
+            remember(0, cols);
+            draw_cursors(0, cols);
+            return;
+        }
+
+        // mostly new row => render it in full and keep a copy (before the cursor is drawn);
+        // on a collision, the entry already there stays
+        bool taken = !!entry;
+
+        if (changed >= cols / 2)
+        {
+            ctx.font->render(image, 0, y, cells);
+            ctx.damage.add(pixman::box{0, y, static_cast<int>(w), y + static_cast<int>(h)});
+
+            if (!taken)
+            {
+                auto row = std::make_shared<cached_row>(pixman::image{w, h}, std::vector<seen_cell>(cols));
+                row->bitmap.fill(0, 0, image, 0, y, w, h);
+                for (int c = 0; c < cols; ++c) row->cells[c].assign(cells[c]);
+
+                // another thread may have put the same row in meanwhile => replaced
+                std::lock_guard lock{rows_mutex_};
+                rows_->insert(key, std::move(row), w * h * sizeof(uint32_t) + cols * sizeof(seen_cell));
+            }
+
+            remember(0, cols);
+            draw_cursors(0, cols);
+            return;
+        }
+    }
+
+    for (auto c = col; c < end; )
+    {
+        if (seen[c].matches(cell(c))) { ++c; continue; }
+
+        auto from = c, to = c + 1;
+        while (to < end && !seen[to].matches(cell(to))) ++to;
+        c = to;
+
+        // don't split wide cells
+        if (from > 0 && !cell(from).len && cell(from - 1).width == 2) --from;
+        if (to < cols && cell(to - 1).width == 2) ++to;
+
+        // re-render cell before in case it overhangs into ours, and cell
+        // after if it's blank and ours overhangs into it
+        if (from > 0 && !font::is_blank(cell(from - 1))) --from;
+        if (to < cols && font::is_blank(cell(to))) ++to;
+
+        int x = from * box_.width;
+        ctx.font->render(image, x, y, std::span{&cell(from), static_cast<std::size_t>(to - from)});
+        ctx.damage.add(pixman::box{x, y, x + static_cast<int>(box_.width) * (to - from), y + static_cast<int>(h)});
 
-        // TODO track damage
+        remember(from, to);
+        draw_cursors(from, to);
     }
 }
 
-void term::update()
+bool term::seen_cell::matches(const vte::cell& cell) const noexcept
 {
-    vte_->commit();
-    if (active_) fb_->commit();
+    return len == cell.len && width == cell.width && style == font::to_style(cell.attrs) && conceal == cell.attrs.conceal
+        && fg == pixman::to_pixel(cell.fg) && bg == pixman::to_pixel(cell.bg)
+        && std::equal(chars, chars + len, cell.chars);
+}
+
+void term::seen_cell::assign(const vte::cell& cell) noexcept
+{
+    fg = pixman::to_pixel(cell.fg);
+    bg = pixman::to_pixel(cell.bg);
+    len = cell.len;
+    width = cell.width;
+    style = font::to_style(cell.attrs);
+    conceal = cell.attrs.conceal;
+    std::copy_n(cell.chars, cell.len, chars);
+}
+
+void term::forget(int row, int col, unsigned count)
+{
+    if (row >= 0 && row < static_cast<int>(size_.rows))
+    {
+        auto from = std::clamp<int>(col, 0, size_.cols), to = std::clamp<int>(col + count, 0, size_.cols);
+        for (auto seen = this->seen(row); from < to; ++from) seen[from].len = seen_cell::unknown;
+    }
+}
+
+cache::stats term::glyph_stats() const
+{
+    cache::stats total;
+    for (auto& ctx : contexts_)
+    {
+        auto stats = ctx.font->glyph_stats();
+        total.hits += stats.hits;
+        total.misses += stats.misses;
+        total.entries += stats.entries;
+        total.size += stats.size;
+    }
+    return total;
+}
+
+cache::stats term::tile_stats() const
+{
+    cache::stats total;
+    for (auto& ctx : contexts_)
+    {
+        auto stats = ctx.font->tile_stats();
+        total.hits += stats.hits;
+        total.misses += stats.misses;
+        total.entries += stats.entries;
+        total.size += stats.size;
+    }
+    return total;
+}
+
+void term::check_allocs()
+{
+    auto stats = alloc::take();
+
+    // frames that had to rasterize new glyphs are still warming up
+    auto misses = glyph_stats().misses;
+    auto tile_misses = tile_stats().misses;
+    auto row_misses = rows_ ? rows_->stats().misses : 0;
+    if (misses == glyph_misses_ && tile_misses == tile_misses_ && row_misses == row_misses_ && stats.total() > alloc_budget_)
+    {
+        {
+            auto log = err();
+            log << "Frame made " << stats.total() << " allocations (budget " << alloc_budget_ << "):";
+
+            for (std::size_t n = 0; n < alloc::num_sites; ++n)
+                if (stats.count[n]) log << " " << alloc::site_names[n] << "=" << stats.count[n] << "/" << stats.bytes[n] << "B";
+        }
+        alloc::take(); // don't charge the report to the next frame
+    }
+    glyph_misses_ = misses;
+    tile_misses_ = tile_misses;
+    row_misses_ = row_misses;
 }
 
 void term::move_cursor(kind k, int row, int col)
 {
-    undraw_cursor(k);
     cursor_[k].row = row;
     cursor_[k].col = col;
-    draw_cursor(k);
+    if (k == mouse) update_pointer();
 }
 
-void term::change(kind k, const vte::cursor& state)
+void term::change(kind k, const vte::cursor& state) { cursor_[k].state = state; }
+
+void term::show_cursor(kind k)
 {
-    undraw_cursor(k);
-    cursor_[k].state = state;
-    draw_cursor(k);
+    if (cursor_[k].state.visible) return;
+    cursor_[k].state.visible = true;
+    if (k == mouse) update_pointer();
 }
 
-void term::show_cursor(kind k) { cursor_[k].state.visible = true; }
-void term::hide_cursor(kind k) { cursor_[k].state.visible = false; undraw_cursor(k); }
+void term::hide_cursor(kind k)
+{
+    if (!cursor_[k].state.visible) return;
+    cursor_[k].state.visible = false;
+    if (k == mouse) update_pointer();
+}
 
-void term::draw_cursor(kind k)
+// cursor cell along with a possible wide cell before it
+void term::invalidate(kind k)
 {
-    auto& cursor = cursor_[k];
-    auto& patch = patch_[k];
+    if (k != mouse || !pointer_)
+    {
+        forget(drawn_[k].row, drawn_[k].col - 1, 3);
+        invalidate(drawn_[k].row, drawn_[k].col - 1, 3);
+    }
+}
 
-    if (cursor.state.visible)
+void term::draw_cursor(kind k, pixman::image& image)
+{
+    auto& cursor = drawn_[k];
+
+    if (cursor.state.visible && (k != mouse || !pointer_))
     {
         // the cursor can land on one of the following:
         //   1. normal cell => render this cell
         //   2. wide   cell => render this cell and the next one (empty)
         //   3. empty  cell => if the prior cell is wide, render that cell and this one
         //
-        auto cells = vte_->cells(cursor.row, cursor.col - 1, 3);
-        auto n = 1;
-        if (!cells[n].len && cells[n - 1].width == 2) --n, --cursor_[k].col;
+        auto cells = vte_->cells(cursor.row, cursor.col - 1, 3, &frame_);
+        auto n = 1, col = cursor.col;
+        if (!cells[n].len && cells[n - 1].width == 2) --n, --col;
 
         auto& cell = cells[n];
 
-        auto x = cursor.col * box_.width, y = cursor.row * box_.height;
+        auto x = col * box_.width, y = cursor.row * box_.height;
         auto w = box_.width * cell.width, h = box_.height;
 
-        patch = pixman::image{w, h};
-        patch->fill(0, 0, fb_->image(), x, y, w, h);
-
         switch (cursor.state.shape)
         {
         case vte::cursor::block:
             std::swap(cell.fg, cell.bg);
-            fb_->image().fill(x, y, pango_->render(std::span{&cell, cell.width}));
+            font_->render(image, x, y, std::span{&cell, cell.width});
             break;
 
         case vte::cursor::vline:
-            fb_->image().fill(x, y, 2, h, cell.fg);
+            image.fill(x, y, 2, h, cell.fg);
             break;
 
         case vte::cursor::hline:
-            fb_->image().fill(x, y + h - 2, w, 2, cell.fg);
+            image.fill(x, y + h - 2, w, 2, cell.fg);
             break;
         };
     }
 }
 
-void term::undraw_cursor(kind k)
+void term::create_pointer()
 {
-    if (patch_[k])
+    try
+    {
+        auto [width, height] = drm_->cursor_size();
+        pointer_ = std::make_unique<drm::framebuf>(*drm_, width, height);
+
+        // cell-sized translucent block with a dark outline (premultiplied a8r8g8b8)
+        auto& image = pointer_->image();
+        auto w = std::min(box_.width, width), h = std::min(box_.height, height);
+
+        auto pitch = image.stride() / 4;
+        auto data = image.data<uint32_t*>();
+        for (unsigned y = 0; y < height; ++y)
+            for (unsigned x = 0; x < width; ++x)
+            {
+                auto edge = (x == 0 || y == 0 || x == w - 1 || y == h - 1);
+                data[y * pitch + x] = (x >= w || y >= h) ? 0 : edge ? 0xff000000 : 0x80808080;
+            }
+    }
+    catch (const std::exception& e)
+    {
+        err() << "Hardware cursor disabled: " << e.what();
+        pointer_.reset();
+    }
+}
+
+void term::update_pointer()
+{
+    if (!pointer_ || !active_) return;
+
+    auto& cursor = cursor_[mouse];
+    bool ok = true;
+
+    if (cursor.state.visible != pointer_shown_)
+    {
+        ok = drm_->set_cursor(cursor.state.visible ? &*pointer_ : nullptr);
+        pointer_shown_ = cursor.state.visible;
+    }
+    if (ok && cursor.state.visible) ok = drm_->move_cursor(cursor.col * box_.width, cursor.row * box_.height);
+
+    if (!ok)
     {
-        auto x = cursor_[k].col * box_.width, y = cursor_[k].row * box_.height;
-        fb_->image().fill(x, y, *patch_[k]);
-        patch_[k].reset();
+        // no cursor plane => fall back to drawing it
+        info() << "Hardware cursor not supported";
+        pointer_.reset();
+        invalidate(mouse);
     }
 }
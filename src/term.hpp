@@ -7,17 +7,26 @@
 ////////////////////////////////////////////////////////////////////////////////
 #pragma once
 
+#include "arena.hpp"
+#include "cache.hpp"
 #include "drm.hpp"
+#include "font.hpp"
 #include "framebuf.hpp"
 #include "mouse.hpp"
 #include "pango.hpp"
 #include "pixman.hpp"
+#include "pool.hpp"
 #include "pty.hpp"
 #include "tty.hpp"
 #include "vte.hpp"
 
 #include <asio/any_io_executor.hpp>
+#include <asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <vector>
@@ -29,8 +38,20 @@ struct term_options
     bool tty_activate = false;
 
     drm::num drm_num;
+    unsigned buffers = 2; // 1 = draw in place, 2-3 = page flipping
+    bool shadow = true; // render in RAM and stream changes to the framebuf
+    bool pan = false; // scroll by panning a double-height framebuf (single buffer only)
+    unsigned max_fps = 0; // 0 = no limit
+    bool latency = false; // present as soon as possible, even at the cost of tearing
     std::optional<unsigned> dpi;
     std::string font = "monospace, 20";
+    std::size_t glyph_cache = 8192; // KiB
+    std::size_t tile_cache = 4096; // KiB, 0 = off
+    std::size_t row_cache = 16384; // KiB, 0 = off
+    pango::shaping shaping = pango::per_cell;
+    bool freetype = false;
+    unsigned threads = 1; // render threads, 0 = one per core
+    std::size_t alloc_budget = 0; // allocations per warm frame (ALLOC_STATS builds)
 
     float mouse_speed = .5;
 
@@ -43,6 +64,7 @@ class term
 public:
     ////////////////////
     term(const asio::any_io_executor&, term_options);
+    ~term();
 
     using exited_callback = pty::device::child_exited_callback;
     void on_exited(exited_callback cb) { pty_->on_child_exited(std::move(cb)); }
@@ -52,24 +74,104 @@ private:
     std::unique_ptr<tty::device> tty_;
 
     std::unique_ptr<drm::device> drm_;
-    std::unique_ptr<drm::framebuf> fb_;
 
-    std::unique_ptr<pango::engine> pango_;
+    struct buffer
+    {
+        std::unique_ptr<drm::framebuf> fb;
+        drm::damage stale; // areas changed since this buffer was last drawn
+    };
+    std::vector<buffer> bufs_;
+    std::size_t shown_ = 0; // on screen
+    std::optional<std::size_t> pending_; // flip queued
+    std::optional<std::size_t> ready_; // drawn and waiting for the pending flip
+    std::size_t last_ = 0; // most recently drawn
+    drm::damage damage_; // accumulated since the last frame
+
+    // copy of the screen in cached memory, so that rendering never reads
+    // from (write-combined) scanout buffers
+    std::optional<pixman::image> shadow_;
+
+    bool pan_ = false; // bufs_[0] is a scrolling ring
+    bool pan_pending_ = false; // scrolled, but scanout not yet moved
+
+    arena::frame frame_{256 * 1024}; // transient buffers, reset every frame
+    std::unique_ptr<font::engine> font_;
     std::unique_ptr<vte::machine> vte_;
     std::unique_ptr<pty::device> pty_;
 
     std::unique_ptr<mouse::device> mouse_;
 
     drm::mode mode_;
-    pango::box box_;
+    font::box box_;
     struct { unsigned rows, cols; } size_;
 
     bool active_ = false;
     void activate();
     void deactivate();
 
-    void update(int row, int col, unsigned count);
+    struct span { int col = 0, end = 0; };
+    std::vector<span> dirty_; // per row
+    bool is_dirty_ = false;
+
+    // what each cell looked like when it was last rendered, so that damage
+    // which doesn't change anything can be skipped
+    struct seen_cell
+    {
+        static constexpr std::uint8_t unknown = 0xff;
+
+        std::uint32_t fg, bg;
+        std::uint8_t len = unknown, width, style;
+        bool conceal;
+        char chars[vte::cell::max_chars];
+
+        bool matches(const vte::cell&) const noexcept;
+        void assign(const vte::cell&) noexcept;
+    };
+    std::vector<seen_cell> grid_;
+    std::size_t cells_rendered_ = 0, cells_skipped_ = 0;
+
+    auto seen(int row) { return &grid_[row * size_.cols]; }
+    void forget(int row, int col, unsigned count); // force re-render
+
+    // fully rendered rows keyed by hash of their cells; the cells are kept
+    // as well, since hashes can collide (and content isn't to be trusted)
+    struct cached_row
+    {
+        pixman::image bitmap;
+        std::vector<seen_cell> cells;
+    };
+    // shared => a hit can be copied out without holding the lock
+    std::optional<cache::lru<std::uint64_t, std::shared_ptr<const cached_row>>> rows_;
+    std::mutex rows_mutex_; // shared by the render threads
+
+    void invalidate(int row, int col, unsigned count);
+    void move(const vte::rect& dst, const vte::rect& src);
+    void schedule();
+
+    struct context;
+    std::optional<std::size_t> acquire();
+    void render(pixman::image&, drm::damage&);
+    void render(pixman::image&, int row, span, context&);
+
     void update();
+    void flipped();
+    void flush(drm::framebuf&);
+
+    // frame pacing
+    using clock = drm::clock;
+    clock::duration frame_time_{}; // frame rate cap
+    clock::time_point last_frame_;
+    clock::duration render_cost_{}; // how long it takes to produce a frame
+
+    // slack for timer wakeup latency
+    static constexpr clock::duration margin = std::chrono::milliseconds{1};
+    asio::steady_timer timer_;
+    bool throttled_ = false;
+    bool latency_ = false;
+
+    std::size_t alloc_budget_;
+    std::size_t glyph_misses_ = 0, tile_misses_ = 0, row_misses_ = 0;
+    void check_allocs();
 
     ////////////////////
     enum kind { mouse, keyboard, size };
@@ -78,9 +180,11 @@ private:
     {
         int row = 0, col = 0;
         vte::cursor state { .shape = vte::cursor::block };
+
+        bool operator==(const cursor&) const = default;
     }
-    cursor_[kind::size];
-    std::optional<pixman::image> patch_[kind::size];
+    cursor_[kind::size], // current state
+    drawn_[kind::size]; // as of the last frame
 
     void move_cursor(kind, int row, int col);
     void change(kind, const vte::cursor&);
@@ -88,6 +192,35 @@ private:
     void show_cursor(kind);
     void hide_cursor(kind);
 
-    void draw_cursor(kind);
-    void undraw_cursor(kind);
+    void invalidate(kind); // where it was last drawn
+    void draw_cursor(kind, pixman::image&);
+
+    // mouse pointer sprite on the hardware cursor plane (if there is one)
+    std::unique_ptr<drm::framebuf> pointer_;
+    bool pointer_shown_ = false;
+
+    void create_pointer();
+    void update_pointer();
+
+    ////////////////////
+    // per-thread rendering state; rows are dealt out to the threads round
+    // robin, so that each one renders its own disjoint set of stripes
+    struct context
+    {
+        font::engine* font;
+        arena::frame* frame;
+
+        drm::damage damage;
+        std::size_t rendered = 0, skipped = 0;
+        bool cursor[kind::size] {}; // cell under it was redrawn
+    };
+    std::vector<context> contexts_; // [0] = main thread
+
+    // fonts and scratch space of the extra threads
+    std::vector<std::unique_ptr<font::engine>> fonts_;
+    std::vector<std::unique_ptr<arena::frame>> frames_;
+    std::unique_ptr<pool::workers> pool_;
+
+    cache::stats glyph_stats() const;
+    cache::stats tile_stats() const;
 };
@@ -5,6 +5,7 @@
 // Distributed under the GNU GPL license. See the LICENSE.md file for details.
 
 ////////////////////////////////////////////////////////////////////////////////
+#include "alloc.hpp"
 #include "logging.hpp"
 #include "vte.hpp"
 
@@ -31,6 +32,15 @@ static int damage(VTermRect rect, void* ctx)
     return true;
 }
 
+static int move_rect(VTermRect dst, VTermRect src, void* ctx)
+{
+    auto vt = static_cast<machine*>(ctx);
+    if (!vt->rect_cb_) return false; // let vterm report it as damage
+
+    vt->rect_cb_(dst, src);
+    return true;
+}
+
 static int move_cursor(VTermPos pos, VTermPos old_pos, int visible, void* ctx)
 {
     auto vt = static_cast<machine*>(ctx);
@@ -103,6 +113,7 @@ machine::machine(unsigned rows, unsigned cols) :
     static const VTermScreenCallbacks callbacks
     {
         .damage      = dispatch::damage,
+        .moverect    = dispatch::move_rect,
         .movecursor  = dispatch::move_cursor,
         .settermprop = dispatch::set_prop,
         .bell        = dispatch::bell,
@@ -292,9 +303,11 @@ void machine::send(std::span<const char> data)
 
 void machine::commit() { vterm_screen_flush_damage(screen_); }
 
-std::vector<vte::cell> machine::cells(int row, int col, unsigned count)
+std::pmr::vector<vte::cell> machine::cells(int row, int col, unsigned count, std::pmr::memory_resource* mr)
 {
-    std::vector<vte::cell> cells;
+    alloc::scope scope{alloc::cells};
+
+    std::pmr::vector<vte::cell> cells{mr};
     cells.reserve(count);
 
     for (; count; ++col, --count) cells.push_back(cell(row, col));
@@ -362,7 +375,16 @@ vte::cell machine::cell(int row, int col)
     VTermScreenCell vtc;
     if (vterm_screen_get_cell(screen_, VTermPos{row, col}, &vtc))
     {
-        ucs4_to_utf8(vtc.chars, cell.chars, &cell.len);
+        // single ascii char (or none) => skip utf-8 conversion
+        auto cp = vtc.chars[0];
+        if (cp < 0x80 && (!cp || !vtc.chars[1]))
+        {
+            cell.chars[0] = cp;
+            cell.len = cp != 0;
+        }
+        else ucs4_to_utf8(vtc.chars, cell.chars, &cell.len);
+
+        if (cp && !vtc.chars[1]) cell.cp = cp;
         cell.width = vtc.width;
         cell.attrs = vtc.attrs;
 
@@ -11,6 +11,7 @@
 
 #include <functional>
 #include <memory>
+#include <memory_resource>
 #include <span>
 #include <vector>
 
@@ -21,6 +22,7 @@ namespace vte
 {
 
 using attrs = VTermScreenCellAttrs;
+using rect = VTermRect;
 using vterm_ptr = std::unique_ptr<VTerm, void(*)(VTerm*)>;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -30,6 +32,7 @@ struct cell
 
     char chars[max_chars];
     std::size_t len;
+    char32_t cp = 0; // cluster is a single code point (0 otherwise)
     unsigned width;
     vte::attrs attrs;
     pixman::color fg, bg;
@@ -40,6 +43,8 @@ struct cursor
     bool visible;
     bool blink;
     enum shape { block, hline, vline } shape;
+
+    bool operator==(const cursor&) const = default;
 };
 
 enum button : unsigned { button_left = 1, button_mid, button_right };
@@ -58,6 +63,11 @@ public:
     using row_changed_callback = std::function<void(int row, int col, unsigned count)>;
     void on_row_changed(row_changed_callback cb) { row_cb_ = std::move(cb); }
 
+    // contents of src were moved to dst (eg, scrolled); only the area
+    // exposed by the move is reported via on_row_changed
+    using rect_moved_callback = std::function<void(const rect& dst, const rect& src)>;
+    void on_rect_moved(rect_moved_callback cb) { rect_cb_ = std::move(cb); }
+
     using cursor_moved_callback = std::function<void(int row, int col)>;
     void on_cursor_moved(cursor_moved_callback cb) { move_cb_ = std::move(cb); }
 
@@ -73,7 +83,7 @@ public:
 
     void commit();
 
-    std::vector<vte::cell> cells(int row, int col, unsigned count);
+    std::pmr::vector<vte::cell> cells(int row, int col, unsigned count, std::pmr::memory_resource* = std::pmr::get_default_resource());
 
     void resize(unsigned rows, unsigned cols);
 
@@ -88,6 +98,7 @@ public:
 
     send_data_callback send_cb_;
     row_changed_callback row_cb_;
+    rect_moved_callback rect_cb_;
 
     cursor_moved_callback move_cb_;
     cursor cursor_;
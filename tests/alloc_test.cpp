@@ -0,0 +1,157 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2025 Dimitry Ishenko
+// Contact: dimitry (dot) ishenko (at) (gee) mail (dot) com
+//
+// Distributed under the GNU GPL license. See the LICENSE.md file for details.
+
+////////////////////////////////////////////////////////////////////////////////
+// Feeds a canned byte stream through vte::machine and renders the changed
+// rows into an in-memory image, the same way the terminal does. Once the
+// caches are warm, every frame must stay within the allocation budget.
+//
+// usage: alloc_test [budget [font]]
+//
+#include "alloc.hpp"
+#include "arena.hpp"
+#include "logging.hpp"
+#include "pango.hpp"
+#include "pixman.hpp"
+#include "vte.hpp"
+
+#include <algorithm> // std::min
+#include <charconv> // std::from_chars
+#include <cstddef>
+#include <exception>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static_assert(alloc::enabled, "alloc_test needs to be built with ALLOC_STATS");
+
+namespace
+{
+
+constexpr unsigned rows = 24, cols = 80;
+constexpr unsigned dpi = 96;
+constexpr std::size_t glyph_cache = 8192 * 1024;
+
+constexpr std::size_t chunk = 256; // bytes received per frame
+constexpr unsigned warm_passes = 2;
+
+// a bit of everything: styles, colours, box drawing, wide and combining
+// chars, and enough lines to scroll several times over
+auto canned_stream()
+{
+    std::string s = "\e[H\e[2J";
+    s += "\e[1mbold\e[0m \e[3mitalic\e[0m \e[4munderline\e[0m \e[9mstrike\e[0m \e[7mreverse\e[0m\r\n";
+    s += "\e[31mred \e[32mgreen \e[38;5;208mindexed \e[38;2;10;200;30;48;2;40;40;40mdirect\e[0m\r\n";
+    s += "┌─┬─┐ │ │ │ └─┴─┘ ░▒▓█ ⣿⡀\r\n";
+    s += "wide: 日本語 combining: é ä\r\n";
+
+    for (unsigned n = 0; n < rows * 4; ++n)
+    {
+        s += "\e[3" + std::to_string(n % 8) + "m" + std::to_string(n) + "\e[0m: the quick brown fox jumps over the lazy dog";
+        s += n % 3 ? "\r\n" : "\e[K\r\n";
+    }
+    s += "\e[5;10H\e[2Kedited\e[10;1H\e[1;33mprompt$ \e[0mls -l\r\n";
+    return s;
+}
+
+void report(std::size_t frame, const alloc::stats& stats, std::size_t budget)
+{
+    auto log = err();
+    log << "Frame " << frame << " made " << stats.total() << " allocations (budget " << budget << "):";
+
+    for (std::size_t n = 0; n < alloc::num_sites; ++n)
+        if (stats.count[n]) log << " " << alloc::site_names[n] << "=" << stats.count[n] << "/" << stats.bytes[n] << "B";
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char* argv[])
+try
+{
+    std::size_t budget = 0;
+    if (argc > 1)
+    {
+        std::string_view val = argv[1];
+        auto [end, ec] = std::from_chars(val.begin(), val.end(), budget);
+        if (ec != std::errc{} || end != val.end()) throw std::invalid_argument{"Invalid budget - " + std::string{val}};
+    }
+    std::string font_desc = argc > 2 ? argv[2] : "monospace, 20";
+
+    arena::frame frame{256 * 1024};
+    pango::engine font{font_desc, dpi, glyph_cache};
+    font.scratch(&frame);
+    auto box = font.box();
+
+    pixman::image image{cols * box.width, rows * box.height};
+
+    vte::machine vte{rows, cols};
+    std::vector<bool> dirty(rows);
+    vte.on_row_changed([&](int row, int, unsigned){ dirty[row] = true; });
+    vte.on_rect_moved([&](auto& dst, auto& src)
+    {
+        int x = src.start_col * box.width, y = src.start_row * box.height;
+        int w = (src.end_col - src.start_col) * box.width, h = (src.end_row - src.start_row) * box.height;
+        image.move(pixman::box{x, y, x + w, y + h}, (dst.start_col - src.start_col) * box.width, (dst.start_row - src.start_row) * box.height);
+    });
+
+    auto stream = canned_stream();
+    auto render = [&](std::span<const char> data)
+    {
+        vte.recv(data);
+        vte.commit();
+
+        for (unsigned row = 0; row < rows; ++row)
+            if (dirty[row])
+            {
+                auto cells = vte.cells(row, 0, cols, &frame);
+                font.render(image, 0, row * box.height, cells);
+                dirty[row] = false;
+            }
+        frame.reset();
+    };
+
+    auto pass = [&](auto&& after_frame)
+    {
+        for (std::size_t off = 0, n = 0; off < stream.size(); off += chunk, ++n)
+        {
+            render(std::span{stream}.subspan(off, std::min(chunk, stream.size() - off)));
+            after_frame(n);
+        }
+    };
+
+    // fill the glyph cache, grow the arena, etc.
+    for (unsigned n = 0; n < warm_passes; ++n) pass([](std::size_t){ });
+    alloc::take();
+
+    std::size_t failed = 0;
+    pass([&](std::size_t n)
+    {
+        auto stats = alloc::take();
+        if (stats.total() > budget)
+        {
+            report(n, stats, budget);
+            alloc::take(); // don't charge the report to the next frame
+            ++failed;
+        }
+    });
+
+    auto frames = (stream.size() + chunk - 1) / chunk;
+    if (failed)
+    {
+        err() << failed << " of " << frames << " warm frames went over budget";
+        return 1;
+    }
+
+    info() << "All " << frames << " warm frames within budget of " << budget << " allocations";
+    return 0;
+}
+catch (const std::exception& e)
+{
+    err() << e.what();
+    return 1;
+}